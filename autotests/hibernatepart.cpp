@@ -0,0 +1,47 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include <kparts/navigationextension.h>
+#include <kparts/readwritepart.h>
+
+#include <QLabel>
+
+#include <KPluginFactory>
+
+/*
+ * A part which PartManager can hibernate, used by partloadertest.
+ * The arguments it was created with are kept in its "arguments" property.
+ */
+class HibernatePart : public KParts::ReadWritePart
+{
+    Q_OBJECT
+public:
+    HibernatePart(QWidget *parentWidget, QObject *parent, const KPluginMetaData &metaData, const QVariantList &args)
+        : KParts::ReadWritePart(parent, metaData)
+    {
+        setProperty("arguments", args);
+        QLabel *label = new QLabel(parentWidget);
+        label->setFocusPolicy(Qt::StrongFocus);
+        setWidget(label);
+        new KParts::NavigationExtension(this);
+    }
+
+protected:
+    bool openFile() override
+    {
+        static_cast<QLabel *>(widget())->setText(localFilePath());
+        return true;
+    }
+
+    bool saveFile() override
+    {
+        return true;
+    }
+};
+
+K_PLUGIN_CLASS_WITH_JSON(HibernatePart, "hibernatepart.json")
+
+#include "hibernatepart.moc"
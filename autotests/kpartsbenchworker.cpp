@@ -0,0 +1,136 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <KIO/WorkerBase>
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QMimeDatabase>
+
+#include <cstdio>
+
+#include <qplatformdefs.h>
+
+class KIOPluginForMetaData : public QObject
+{
+    Q_OBJECT
+    Q_PLUGIN_METADATA(IID "org.kde.kio.worker.kpartsbench" FILE "kpartsbenchworker.json")
+};
+
+/*
+ * Serves kpartsbench:/some/path from the local file /some/path, so that the
+ * remote code paths of ReadWritePart can be benchmarked without a network.
+ */
+class BenchWorker : public KIO::WorkerBase
+{
+public:
+    BenchWorker(const QByteArray &poolSocket, const QByteArray &appSocket)
+        : KIO::WorkerBase(QByteArrayLiteral("kpartsbench"), poolSocket, appSocket)
+    {
+    }
+
+    KIO::WorkerResult get(const QUrl &url) override
+    {
+        QFile file(url.path());
+        if (!file.open(QIODevice::ReadOnly)) {
+            return KIO::WorkerResult::fail(KIO::ERR_CANNOT_OPEN_FOR_READING, url.path());
+        }
+        mimeType(QMimeDatabase().mimeTypeForFile(url.path(), QMimeDatabase::MatchExtension).name());
+        totalSize(file.size());
+
+        KIO::filesize_t processed = 0;
+        while (!file.atEnd()) {
+            const QByteArray chunk = file.read(s_chunkSize);
+            if (chunk.isEmpty()) {
+                return KIO::WorkerResult::fail(KIO::ERR_CANNOT_READ, url.path());
+            }
+            data(chunk);
+            processed += chunk.size();
+            processedSize(processed);
+        }
+        data(QByteArray());
+        return KIO::WorkerResult::pass();
+    }
+
+    KIO::WorkerResult put(const QUrl &url, int permissions, KIO::JobFlags flags) override
+    {
+        Q_UNUSED(permissions)
+
+        QFile file(url.path());
+        if (file.exists() && !(flags & KIO::Overwrite)) {
+            return KIO::WorkerResult::fail(KIO::ERR_FILE_ALREADY_EXIST, url.path());
+        }
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            return KIO::WorkerResult::fail(KIO::ERR_CANNOT_OPEN_FOR_WRITING, url.path());
+        }
+
+        int result;
+        do {
+            QByteArray buffer;
+            dataReq();
+            result = readData(buffer);
+            if (result > 0 && file.write(buffer) != buffer.size()) {
+                file.remove();
+                return KIO::WorkerResult::fail(KIO::ERR_CANNOT_WRITE, url.path());
+            }
+        } while (result > 0);
+
+        if (result < 0) {
+            file.remove();
+            return KIO::WorkerResult::fail(KIO::ERR_CANNOT_WRITE, url.path());
+        }
+        return KIO::WorkerResult::pass();
+    }
+
+    KIO::WorkerResult stat(const QUrl &url) override
+    {
+        const QFileInfo info(url.path());
+        if (!info.exists()) {
+            return KIO::WorkerResult::fail(KIO::ERR_DOES_NOT_EXIST, url.path());
+        }
+        KIO::UDSEntry entry;
+        entry.reserve(4);
+        entry.fastInsert(KIO::UDSEntry::UDS_NAME, info.fileName());
+        entry.fastInsert(KIO::UDSEntry::UDS_FILE_TYPE, info.isDir() ? QT_STAT_DIR : QT_STAT_REG);
+        entry.fastInsert(KIO::UDSEntry::UDS_SIZE, info.size());
+        entry.fastInsert(KIO::UDSEntry::UDS_MODIFICATION_TIME, info.lastModified().toSecsSinceEpoch());
+        statEntry(entry);
+        return KIO::WorkerResult::pass();
+    }
+
+    KIO::WorkerResult del(const QUrl &url, bool isFile) override
+    {
+        Q_UNUSED(isFile)
+
+        if (!QFile::remove(url.path())) {
+            return KIO::WorkerResult::fail(KIO::ERR_CANNOT_DELETE, url.path());
+        }
+        return KIO::WorkerResult::pass();
+    }
+
+private:
+    static constexpr qint64 s_chunkSize = 1024 * 1024;
+};
+
+extern "C" Q_DECL_EXPORT int kdemain(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QStringLiteral("kio_kpartsbench"));
+
+    if (argc != 4) {
+        fprintf(stderr, "Usage: kio_kpartsbench protocol domain-socket1 domain-socket2\n");
+        return -1;
+    }
+
+    BenchWorker worker(argv[2], argv[3]);
+    worker.dispatchLoop();
+    return 0;
+}
+
+#include "kpartsbenchworker.moc"
@@ -6,12 +6,17 @@
 
 #include "partloader.h"
 #include <KParts/PartLoader>
-#include <KParts/ReadOnlyPart>
+#include <KParts/PartManager>
+#include <KParts/ReadWritePart>
+#include <QSignalSpy>
 #include <QTest>
+#include <QVBoxLayout>
 
 #include <KPluginMetaData>
+#include <QApplication>
 #include <QDebug>
 #include <QJsonArray>
+#include <QPointer>
 #include <QStandardPaths>
 
 class PartLoaderTest : public QObject
@@ -85,6 +90,59 @@ private Q_SLOTS:
         QCOMPARE(result.plugin->metaObject()->className(), "NotepadPart");
     }
 
+    void shouldHibernateAndRestorePart()
+    {
+        const QString testFile = QFINDTESTDATA("partloadertest.cpp");
+        QVERIFY(!testFile.isEmpty());
+        const KPluginMetaData md(QStringLiteral("kf6/parts/hibernatepart"));
+        QVERIFY(md.isValid());
+        const QVariantList args{QStringLiteral("restored-with"), 42};
+
+        QWidget window;
+        QVBoxLayout *layout = new QVBoxLayout(&window);
+        QWidget *other = new QWidget(&window);
+        other->setFocusPolicy(Qt::StrongFocus);
+        layout->addWidget(other);
+        KParts::PartManager manager(&window);
+        const auto result = KParts::PartLoader::instantiatePart<KParts::ReadWritePart>(md, &window, this, args);
+        QVERIFY(result);
+        QPointer<KParts::ReadWritePart> part = result.plugin;
+        layout->insertWidget(0, part->widget());
+        QVERIFY(part->openUrl(QUrl::fromLocalFile(testFile)));
+        manager.addPart(part, false);
+        window.show();
+        QVERIFY(QTest::qWaitForWindowActive(&window));
+        other->setFocus();
+
+        // A modified document can't be recreated from its URL
+        part->setModified(true);
+        QVERIFY(!manager.hibernatePart(part, args));
+        part->setModified(false);
+
+        QSignalSpy hibernatedSpy(&manager, &KParts::PartManager::partHibernated);
+        QWidget *placeholder = manager.hibernatePart(part, args);
+        QVERIFY(placeholder);
+        QVERIFY(manager.isHibernatedPlaceholder(placeholder));
+        QCOMPARE(hibernatedSpy.count(), 1);
+        QCOMPARE(layout->indexOf(placeholder), 0);
+        QVERIFY(!manager.parts().contains(part));
+        QTRY_VERIFY(!part);
+
+        // Clicking the placeholder brings the part back, with its arguments and its document
+        QSignalSpy restoredSpy(&manager, &KParts::PartManager::partRestored);
+        QTest::mouseClick(placeholder, Qt::LeftButton);
+        QCOMPARE(restoredSpy.count(), 1);
+        auto *restored = restoredSpy.at(0).at(1).value<KParts::ReadOnlyPart *>();
+        QVERIFY(restored);
+        QCOMPARE(restored->property("arguments").toList(), args);
+        QCOMPARE(manager.activePart(), restored);
+        QCOMPARE(restored->url(), QUrl::fromLocalFile(testFile));
+        QCOMPARE(layout->indexOf(restored->widget()), 0);
+        QCOMPARE(QApplication::focusWidget(), restored->widget());
+        QVERIFY(!manager.isHibernatedPlaceholder(placeholder));
+        delete restored;
+    }
+
     void testPartCapabilities()
     {
         const KPluginMetaData md(QStringLiteral("kf6/parts/notepadpart"));
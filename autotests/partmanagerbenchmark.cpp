@@ -0,0 +1,135 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <KParts/Part>
+#include <KParts/PartManager>
+#include <QTest>
+
+#include <QMouseEvent>
+#include <QTimerEvent>
+#include <QWidget>
+
+#include <memory>
+#include <vector>
+
+/*
+ * Measures the cost of the part managers' event filtering for events
+ * they don't act upon, and for clicks inside a managed window.
+ */
+
+class BenchPart : public KParts::Part
+{
+public:
+    explicit BenchPart(QWidget *parentWidget)
+    {
+        setWidget(new QWidget(parentWidget));
+    }
+};
+
+class PartManagerBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void benchmarkUnrelatedEvents_data();
+    void benchmarkUnrelatedEvents();
+    void benchmarkClicks_data();
+    void benchmarkClicks();
+
+private:
+    void createManagers(int count, KParts::PartManager::EventDispatchMode mode);
+    void addData();
+
+    // Destroyed in reverse order: parts, then managers, then windows
+    std::vector<std::unique_ptr<QWidget>> m_windows;
+    std::vector<std::unique_ptr<KParts::PartManager>> m_managers;
+    std::vector<std::unique_ptr<BenchPart>> m_parts;
+};
+
+void PartManagerBenchmark::addData()
+{
+    QTest::addColumn<int>("managers");
+    QTest::addColumn<KParts::PartManager::EventDispatchMode>("mode");
+
+    for (int count : {1, 10, 100}) {
+        QTest::addRow("application-filter/%d", count) << count << KParts::PartManager::ApplicationEventFilter;
+        QTest::addRow("shared-dispatcher/%d", count) << count << KParts::PartManager::SharedDispatcher;
+    }
+}
+
+void PartManagerBenchmark::createManagers(int count, KParts::PartManager::EventDispatchMode mode)
+{
+    m_parts.clear();
+    m_managers.clear();
+    m_windows.clear();
+    for (int i = 0; i < count; ++i) {
+        auto window = std::make_unique<QWidget>();
+        auto manager = std::make_unique<KParts::PartManager>(window.get());
+        manager->setEventDispatchMode(mode);
+        auto part = std::make_unique<BenchPart>(window.get());
+        manager->addPart(part.get(), false);
+        m_windows.push_back(std::move(window));
+        m_managers.push_back(std::move(manager));
+        m_parts.push_back(std::move(part));
+    }
+}
+
+void PartManagerBenchmark::benchmarkUnrelatedEvents_data()
+{
+    addData();
+}
+
+// Timer and paint-like events, which every application sees in large numbers
+void PartManagerBenchmark::benchmarkUnrelatedEvents()
+{
+    QFETCH(int, managers);
+    QFETCH(KParts::PartManager::EventDispatchMode, mode);
+    createManagers(managers, mode);
+
+    QObject object;
+    QWidget widget;
+    QTimerEvent timerEvent(1);
+    QEvent updateEvent(QEvent::UpdateLater);
+    QBENCHMARK {
+        for (int i = 0; i < 1000; ++i) {
+            QCoreApplication::sendEvent(&object, &timerEvent);
+            QCoreApplication::sendEvent(&widget, &updateEvent);
+        }
+    }
+    m_parts.clear();
+    m_managers.clear();
+    m_windows.clear();
+}
+
+void PartManagerBenchmark::benchmarkClicks_data()
+{
+    addData();
+}
+
+// Clicks inside the part of the window managed by the last manager
+void PartManagerBenchmark::benchmarkClicks()
+{
+    QFETCH(int, managers);
+    QFETCH(KParts::PartManager::EventDispatchMode, mode);
+    createManagers(managers, mode);
+
+    QWidget *target = m_parts.back()->widget();
+    const QPointF pos(1, 1);
+    QMouseEvent press(QEvent::MouseButtonPress, pos, target->mapToGlobal(pos), Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+    QBENCHMARK {
+        for (int i = 0; i < 1000; ++i) {
+            QCoreApplication::sendEvent(target, &press);
+        }
+    }
+    QCOMPARE(m_managers.back()->activePart(), m_parts.back().get());
+    m_parts.clear();
+    m_managers.clear();
+    m_windows.clear();
+}
+
+QTEST_MAIN(PartManagerBenchmark)
+
+#include "partmanagerbenchmark.moc"
@@ -8,12 +8,36 @@
 #include <qtest_widgets.h>
 
 #include <KSharedConfig>
+#include <KStandardGuiItem>
+#include <QApplication>
+#include <QDataStream>
+#include <QDir>
+#include <QDomDocument>
+#include <QFileInfo>
+#include <QFocusEvent>
+#include <QMenu>
+#include <QPushButton>
 #include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
 #include <QTest>
+#include <QTimer>
 #include <QWidget>
 #include <kparts/guiactivateevent.h>
+#include <kparts/navigationextension.h>
 #include <kparts/openurlarguments.h>
+#include <kparts/partactivateevent.h>
+#include <kparts/partmanager.h>
+#include <kparts/partsuspendevent.h>
 #include <kparts/readonlypart.h>
+#include <kparts/readwritepart.h>
+
+#include <qplatformdefs.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 QTEST_MAIN(PartTest)
 
@@ -38,7 +62,23 @@ public:
         qDebug() << "url changed: " << url;
     }
 
+    using KParts::ReadOnlyPart::setWidget;
+    using KParts::ReadOnlyPart::setXML;
+    using KParts::ReadOnlyPart::setXMLFile;
+
+    KParts::Part *hitTest(QWidget *widget, const QPoint &globalPos) override
+    {
+        if (m_declineHitTest) {
+            return nullptr;
+        }
+        return widget == m_claimedWidget ? this : KParts::ReadOnlyPart::hitTest(widget, globalPos);
+    }
+
     bool m_guiActivationEventTriggered = false;
+    bool m_suspended = false;
+    bool m_activated = false;
+    bool m_declineHitTest = false;
+    QWidget *m_claimedWidget = nullptr;
 
 protected:
     bool openFile() override
@@ -50,11 +90,27 @@ protected:
     {
         m_guiActivationEventTriggered = true;
     }
+    void partActivateEvent(KParts::PartActivateEvent *event) override
+    {
+        m_activated = event->activated();
+    }
+    void customEvent(QEvent *event) override
+    {
+        if (KParts::PartSuspendEvent::test(event)) {
+            m_suspended = static_cast<KParts::PartSuspendEvent *>(event)->suspended();
+        }
+        KParts::ReadOnlyPart::customEvent(event);
+    }
 
 private:
     bool m_openFileCalled;
 };
 
+void PartTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+}
+
 void PartTest::testAutoDeletePart()
 {
     KParts::Part *part = new TestPart(nullptr, nullptr);
@@ -97,6 +153,41 @@ void PartTest::testNoAutoDeleteWidget()
     delete widget;
 }
 
+class TestReadWritePart : public KParts::ReadWritePart
+{
+public:
+    TestReadWritePart(QObject *parent, QWidget *parentWidget)
+        : KParts::ReadWritePart(parent)
+    {
+        setWidget(new QWidget(parentWidget));
+    }
+
+    using KParts::ReadWritePart::appendToRecoveryJournal;
+    using KParts::ReadWritePart::writeRecoverySnapshot;
+    using KParts::ReadWritePart::setUrl;
+
+    QByteArray m_data;
+
+protected:
+    bool openFile() override
+    {
+        QFile file(localFilePath());
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        m_data = file.readAll();
+        return true;
+    }
+    bool saveFile() override
+    {
+        QFile file(localFilePath());
+        if (!file.open(QIODevice::WriteOnly)) {
+            return false;
+        }
+        return file.write(m_data) == m_data.size();
+    }
+};
+
 // There is no operator== in OpenUrlArguments because it's only useful in unit tests
 static bool compareArgs(const KParts::OpenUrlArguments &arg1, const KParts::OpenUrlArguments &arg2)
 {
@@ -190,9 +281,12 @@ void PartTest::testEmptyUrlAfterCloseUrl()
     delete part;
 }
 
+#include <KActionCollection>
 #include <KConfigGroup>
+#include <KEditToolBar>
 #include <KToggleToolBarAction>
 #include <KToolBar>
+#include <KXMLGUIFactory>
 #include <kparts/mainwindow.h>
 class MyMainWindow : public KParts::MainWindow
 {
@@ -239,6 +333,238 @@ public:
         close();
     }
 
+    void testIncrementalGUIMerge()
+    {
+        TestPart part1(nullptr, nullptr);
+        TestPart part2(nullptr, nullptr);
+        TestPart part3(nullptr, nullptr);
+        const QString editMenuXML = QStringLiteral("<!DOCTYPE gui><gui name=\"testpart\"><MenuBar><Menu name=\"edit\"/></MenuBar></gui>");
+        part3.setXML(editMenuXML);
+
+        createGUI(&part1);
+        QVERIFY(!guiMergeStatistics().incremental);
+
+        // Same menus and toolbars: only the actions are swapped
+        createGUI(&part2);
+        QVERIFY(guiMergeStatistics().incremental);
+        QCOMPARE(guiMergeStatistics().clientsRemoved, 1);
+        QCOMPARE(guiMergeStatistics().clientsAdded, 1);
+        QVERIFY(guiFactory()->clients().contains(&part2));
+        QVERIFY(!guiFactory()->clients().contains(&part1));
+        QVERIFY(updatesEnabled());
+
+        createGUI(&part3);
+        QVERIFY(!guiMergeStatistics().incremental);
+        QVERIFY(!guiFactory()->clients().contains(&part2));
+
+        createGUI(nullptr);
+        QVERIFY(!guiMergeStatistics().incremental);
+        QVERIFY(!guiFactory()->clients().contains(&part3));
+
+        // A part changing its GUI description after a merge is noticed
+        createGUI(&part1);
+        part2.setXML(editMenuXML);
+        createGUI(&part2);
+        QVERIFY(!guiMergeStatistics().incremental);
+        createGUI(&part3);
+        QVERIFY(guiMergeStatistics().incremental);
+
+        createGUI(nullptr);
+    }
+
+    void testGUIMergeStatistics()
+    {
+        KParts::PartManager manager(this);
+        connect(&manager, &KParts::PartManager::activePartChanged, this, &MyMainWindow::createGUI);
+        TestPart *part1 = new TestPart(nullptr, this);
+        TestPart *part2 = new TestPart(nullptr, this);
+        manager.addParts({part1, part2});
+        QCOMPARE(guiMergeStatistics().mergeCount, 0);
+
+        manager.setActivePart(part1);
+        manager.setActivePart(part2);
+        const GUIMergeStatistics stats = guiMergeStatistics();
+        QCOMPARE(stats.mergeCount, 2);
+        QCOMPARE(stats.clientsRemoved, 1);
+        QCOMPARE(stats.clientsAdded, 1);
+        QVERIFY(stats.removeNsecs > 0);
+        QVERIFY(stats.addNsecs > 0);
+        QVERIFY(stats.activateNsecs > 0);
+        QCOMPARE(stats.paintNsecs, -1); // never shown
+
+        // The GUI merge happens while activePartChanged() is emitted
+        const KParts::PartManager::ActivationTimings timings = manager.lastActivationTimings();
+        QVERIFY(timings.deactivationNsecs > 0);
+        QVERIFY(timings.activationNsecs > 0);
+        QVERIFY(timings.notificationNsecs >= stats.removeNsecs + stats.addNsecs + stats.activateNsecs);
+
+        resetGUIMergeStatistics();
+        QCOMPARE(guiMergeStatistics().mergeCount, 0);
+        QCOMPARE(guiMergeStatistics().clientsRemoved, 0);
+        QCOMPARE(guiMergeStatistics().clientsAdded, 0);
+        QVERIFY(!guiMergeStatistics().incremental);
+        QCOMPARE(guiMergeStatistics().addNsecs, 0);
+        QCOMPARE(guiMergeStatistics().paintNsecs, -1);
+        manager.setActivePart(part1);
+        QCOMPARE(guiMergeStatistics().mergeCount, 1);
+
+        delete part1; // deactivates it, and merges no part
+        delete part2;
+        QCOMPARE(guiMergeStatistics().mergeCount, 2);
+        QCOMPARE(guiMergeStatistics().clientsAdded, 0);
+    }
+
+    void testToolBarConfig()
+    {
+        createGUI(nullptr);
+        KToolBar *edited = new KToolBar(QStringLiteral("edited"), this);
+        KToolBar *untouched = new KToolBar(QStringLiteral("untouched"), this);
+
+        configureToolbars();
+        QPointer<KEditToolBar> editor = findChild<KEditToolBar *>(QString(), Qt::FindDirectChildrenOnly);
+        QVERIFY(editor);
+
+        // Settings which applying would make visible
+        KConfigGroup cg(KSharedConfig::openConfig(), QString());
+        KConfigGroup(&cg, QStringLiteral("Toolbar edited")).writeEntry("ToolButtonStyle", "TextOnly");
+        KConfigGroup(&cg, QStringLiteral("Toolbar untouched")).writeEntry("ToolButtonStyle", "TextOnly");
+        edited->setToolButtonStyle(Qt::ToolButtonIconOnly);
+        untouched->setToolButtonStyle(Qt::ToolButtonIconOnly);
+
+        // Only the toolbar the dialog changed gets its settings again
+        edited->addAction(QStringLiteral("new action"));
+        Q_EMIT editor->newToolBarConfig();
+        QCOMPARE(edited->toolButtonStyle(), Qt::ToolButtonTextOnly);
+        QCOMPARE(untouched->toolButtonStyle(), Qt::ToolButtonIconOnly);
+
+        // Any other caller gets the whole GUI rebuilt
+        edited->setToolButtonStyle(Qt::ToolButtonIconOnly);
+        saveNewToolbarConfig();
+        QCOMPARE(edited->toolButtonStyle(), Qt::ToolButtonTextOnly);
+        QCOMPARE(untouched->toolButtonStyle(), Qt::ToolButtonTextOnly);
+
+        delete editor;
+        cg.deleteGroup(QStringLiteral("Toolbar edited"));
+        cg.deleteGroup(QStringLiteral("Toolbar untouched"));
+        delete edited;
+        delete untouched;
+    }
+
+    void testLazyShellGUI()
+    {
+        setLazyShellGUI(true);
+        TestPart part(nullptr, nullptr);
+        createGUI(&part);
+        QVERIFY(!actionCollection()->action(QStringLiteral("help_about_kde")));
+        const int clients = guiFactory()->clients().count();
+
+        // Added once the event loop is idle
+        QTRY_VERIFY(actionCollection()->action(QStringLiteral("help_about_kde")));
+        QCOMPARE(guiFactory()->clients().count(), clients + 1);
+
+        createGUI(nullptr);
+    }
+
+    void testShortcutIndex()
+    {
+        TestPart part(nullptr, nullptr);
+        QAction *partAction = part.actionCollection()->addAction(QStringLiteral("test_help"));
+        partAction->setShortcut(Qt::Key_F1);
+
+        QSignalSpy conflictSpy(this, &KParts::MainWindow::shortcutConflict);
+        createGUI(nullptr);
+        QCOMPARE(actionsForShortcut(QKeySequence(Qt::Key_F1)).count(), 1); // help_contents
+        QCOMPARE(conflictSpy.count(), 0);
+
+        createGUI(&part);
+        QCOMPARE(conflictSpy.count(), 1);
+        QCOMPARE(conflictSpy.at(0).at(0).value<QKeySequence>(), QKeySequence(Qt::Key_F1));
+        QVERIFY(actionsForShortcut(QKeySequence(Qt::Key_F1)).contains(partAction));
+
+        // Changing the shortcut updates the index
+        partAction->setShortcut(Qt::Key_F12);
+        QCOMPARE(actionsForShortcut(QKeySequence(Qt::Key_F1)).count(), 1);
+        QCOMPARE(actionsForShortcut(QKeySequence(Qt::Key_F12)), QList<QAction *>{partAction});
+
+        createGUI(nullptr);
+        QVERIFY(actionsForShortcut(QKeySequence(Qt::Key_F12)).isEmpty());
+        QCOMPARE(conflictSpy.count(), 1);
+
+        // Switching back to the part doesn't report the same conflict again
+        partAction->setShortcut(Qt::Key_F1);
+        createGUI(&part);
+        createGUI(nullptr);
+        createGUI(&part);
+        QCOMPARE(conflictSpy.count(), 1);
+
+        // Disabled actions don't take part
+        partAction->setEnabled(false);
+        QCOMPARE(actionsForShortcut(QKeySequence(Qt::Key_F1)).count(), 1);
+        partAction->setEnabled(true);
+        QCOMPARE(actionsForShortcut(QKeySequence(Qt::Key_F1)).count(), 2);
+        QCOMPARE(conflictSpy.count(), 1);
+
+        // Nor do actions which can't be triggered in the same widgets
+        QWidget first(this);
+        QWidget second(this);
+        QAction *firstAction = part.actionCollection()->addAction(QStringLiteral("test_first"));
+        QAction *secondAction = part.actionCollection()->addAction(QStringLiteral("test_second"));
+        firstAction->setShortcutContext(Qt::WidgetWithChildrenShortcut);
+        secondAction->setShortcutContext(Qt::WidgetWithChildrenShortcut);
+        firstAction->setShortcut(Qt::CTRL | Qt::SHIFT | Qt::Key_F11);
+        secondAction->setShortcut(Qt::CTRL | Qt::SHIFT | Qt::Key_F11);
+        first.addAction(firstAction);
+        second.addAction(secondAction);
+        createGUI(nullptr);
+        createGUI(&part);
+        QCOMPARE(actionsForShortcut(QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_F11)).count(), 2);
+        QCOMPARE(conflictSpy.count(), 1);
+
+        createGUI(nullptr);
+    }
+
+    void testPreparedGUI()
+    {
+        TestPart part1(nullptr, nullptr);
+        TestPart part2(nullptr, nullptr);
+        QAction *action = part2.actionCollection()->addAction(QStringLiteral("test_prepared"));
+        QAction *hiddenByPart = part2.actionCollection()->addAction(QStringLiteral("test_hidden_by_part"));
+        part2.setXML(QStringLiteral(
+            "<!DOCTYPE gui><gui name=\"testpart\"><MenuBar><Menu name=\"file\"><Menu name=\"test_submenu\"><text>Sub</text>"
+            "<Action name=\"test_prepared\"/><Action name=\"test_hidden_by_part\"/></Menu></Menu></MenuBar></gui>"));
+
+        createGUI(&part1);
+        prepareGUI(&part2);
+        QVERIFY(isGUIPrepared(&part2));
+        QVERIFY(guiFactory()->clients().contains(&part2));
+        QVERIFY(!action->isVisible());
+        // Sub-menus only the part has are hidden too
+        QMenu *subMenu = findChild<QMenu *>(QStringLiteral("test_submenu"));
+        QVERIFY(subMenu);
+        QVERIFY(!subMenu->menuAction()->isVisible());
+
+        // The part hiding an action meanwhile is kept
+        hiddenByPart->setVisible(false);
+
+        // Activation only reveals it
+        createGUI(&part2);
+        QVERIFY(!isGUIPrepared(&part2));
+        QVERIFY(action->isVisible());
+        QVERIFY(!hiddenByPart->isVisible());
+        QVERIFY(subMenu->menuAction()->isVisible());
+        QCOMPARE(guiMergeStatistics().clientsAdded, 0);
+        QVERIFY(guiFactory()->clients().contains(&part2));
+        QVERIFY(!guiFactory()->clients().contains(&part1));
+
+        prepareGUI(&part1);
+        QVERIFY(guiFactory()->clients().contains(&part1));
+        discardPreparedGUI(&part1);
+        QVERIFY(!isGUIPrepared(&part1));
+        QVERIFY(!guiFactory()->clients().contains(&part1));
+
+        createGUI(nullptr);
+    }
+
 private:
     KToolBar *tb;
 };
@@ -256,6 +582,312 @@ void PartTest::testToolbarVisibility()
     window.testToolbarVisibility();
 }
 
+void PartTest::testIncrementalGUIMerge()
+{
+    MyMainWindow window;
+    window.testIncrementalGUIMerge();
+}
+
+void PartTest::testGUIMergeStatistics()
+{
+    MyMainWindow window;
+    window.testGUIMergeStatistics();
+}
+
+void PartTest::testToolBarConfig()
+{
+    MyMainWindow window;
+    window.testToolBarConfig();
+}
+
+void PartTest::testLazyShellGUI()
+{
+    MyMainWindow window;
+    window.testLazyShellGUI();
+}
+
+void PartTest::testShortcutIndex()
+{
+    MyMainWindow window;
+    window.testShortcutIndex();
+}
+
+void PartTest::testPreparedGUI()
+{
+    MyMainWindow window;
+    window.testPreparedGUI();
+}
+
+void PartTest::testSharedGUIDocument()
+{
+    const QString rcFile = QFINDTESTDATA("notepadpart.rc");
+    QVERIFY(!rcFile.isEmpty());
+    TestPart part1(nullptr, nullptr);
+    TestPart part2(nullptr, nullptr);
+    part1.setXMLFile(rcFile);
+    part2.setXMLFile(rcFile);
+    QVERIFY(!part1.domDocument().isNull());
+    // Same content, but each part has its own document
+    QCOMPARE(part1.domDocument().toString(), part2.domDocument().toString());
+    QVERIFY(part1.domDocument() != part2.domDocument());
+
+    // Changes to one document don't leak into the other
+    const QString original = part1.domDocument().toString();
+    part2.domDocument().documentElement().setAttribute(QStringLiteral("edited"), QStringLiteral("1"));
+    QCOMPARE(part1.domDocument().toString(), original);
+    part2.setXML(QStringLiteral("<!DOCTYPE gui><gui name=\"notepadpart\"><MenuBar><Menu name=\"extra\"><text>Extra</text></Menu></MenuBar></gui>"), true);
+    QCOMPARE(part1.domDocument().toString(), original);
+
+    // A third instance still gets the original description
+    TestPart part3(nullptr, nullptr);
+    part3.setXMLFile(rcFile);
+    QCOMPARE(part3.domDocument().toString(), original);
+
+    // A file changed on disk is read again
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString copiedFile = dir.filePath(QStringLiteral("copied.rc"));
+    QVERIFY(QFile::copy(rcFile, copiedFile));
+    TestPart part4(nullptr, nullptr);
+    part4.setXMLFile(copiedFile);
+    QCOMPARE(part4.domDocument().toString(), original);
+    {
+        QFile file(copiedFile);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        file.write("<!DOCTYPE gui><gui name=\"notepadpart\"><MenuBar><Menu name=\"changed\"/></MenuBar></gui>");
+    }
+    TestPart part5(nullptr, nullptr);
+    part5.setXMLFile(copiedFile);
+    QVERIFY(part5.domDocument().toString().contains(QLatin1String("changed")));
+}
+
+void PartTest::testNavigationRequestQueue()
+{
+    TestPart part(nullptr, nullptr);
+    auto *extension = new KParts::NavigationExtension(&part);
+    QSignalSpy spy(extension, &KParts::NavigationExtension::openUrlRequestDelayed);
+
+    for (int i = 0; i < 3; ++i) {
+        Q_EMIT extension->openUrlRequest(QUrl(QStringLiteral("file:///tmp/%1").arg(i)));
+    }
+    QCOMPARE(extension->requestQueueStatistics().pending, 3);
+    QTRY_COMPARE(spy.count(), 3);
+    QCOMPARE(spy.at(0).at(0).toUrl(), QUrl(QStringLiteral("file:///tmp/0")));
+    QCOMPARE(spy.at(2).at(0).toUrl(), QUrl(QStringLiteral("file:///tmp/2")));
+    QCOMPARE(extension->requestQueueStatistics().pending, 0);
+    QCOMPARE(extension->requestQueueStatistics().maximumPending, 3);
+
+    // Bounded queue
+    spy.clear();
+    extension->setMaximumPendingRequests(2);
+    for (int i = 0; i < 3; ++i) {
+        Q_EMIT extension->openUrlRequest(QUrl(QStringLiteral("file:///tmp/%1").arg(i)));
+    }
+    QTRY_COMPARE(spy.count(), 2);
+    QCOMPARE(spy.at(0).at(0).toUrl(), QUrl(QStringLiteral("file:///tmp/1")));
+    QCOMPARE(extension->requestQueueStatistics().dropped, 1);
+
+    // A request always waits for the event loop
+    spy.clear();
+    extension->setMaximumPendingRequests(0);
+    QCOMPARE(extension->maximumPendingRequests(), 1);
+    Q_EMIT extension->openUrlRequest(QUrl(QStringLiteral("file:///tmp/0")));
+    Q_EMIT extension->openUrlRequest(QUrl(QStringLiteral("file:///tmp/1")));
+    QCOMPARE(spy.count(), 0);
+    QTRY_COMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toUrl(), QUrl(QStringLiteral("file:///tmp/1")));
+    QCOMPARE(extension->requestQueueStatistics().dropped, 2);
+    extension->setMaximumPendingRequests(-1);
+
+    // Only the last request matters
+    spy.clear();
+    extension->setRequestPolicy(KParts::NavigationExtension::LatestRequestWins);
+    for (int i = 0; i < 3; ++i) {
+        Q_EMIT extension->openUrlRequest(QUrl(QStringLiteral("file:///tmp/%1").arg(i)));
+    }
+    QTRY_COMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toUrl(), QUrl(QStringLiteral("file:///tmp/2")));
+    QCOMPARE(extension->requestQueueStatistics().coalesced, 2);
+    QCOMPARE(extension->requestQueueStatistics().emitted, 6);
+}
+
+void PartTest::testNavigationActionStatus()
+{
+    QCOMPARE(KParts::NavigationExtension::actionId("copy"), 0);
+    QCOMPARE(KParts::NavigationExtension::actionId("cut"), 1);
+    QCOMPARE(KParts::NavigationExtension::actionId("paste"), 2);
+    QCOMPARE(KParts::NavigationExtension::actionId("print"), 3);
+    QCOMPARE(KParts::NavigationExtension::actionId("prunt"), -1);
+    QCOMPARE(KParts::NavigationExtension::actionId("reload"), -1);
+    QCOMPARE(KParts::NavigationExtension::actionId(""), -1);
+
+    // Every slot-map entry resolves, and its id is its position in the map
+    int expectedId = 0;
+    const KParts::NavigationExtension::ActionSlotMap *slotMap = KParts::NavigationExtension::actionSlotMap();
+    for (auto it = slotMap->cbegin(); it != slotMap->cend(); ++it, ++expectedId) {
+        QCOMPARE(KParts::NavigationExtension::actionId(it.key().constData()), expectedId);
+        QCOMPARE(it.value(), QByteArray(SLOT(xxx())).replace("xxx", it.key()));
+    }
+    QCOMPARE(expectedId, 4);
+
+    TestPart part(nullptr, nullptr);
+    auto *extension = new KParts::NavigationExtension(&part);
+    const int paste = KParts::NavigationExtension::actionId("paste");
+    QVERIFY(!extension->isActionEnabled(paste));
+    Q_EMIT extension->enableAction("paste", true);
+    QVERIFY(extension->isActionEnabled(paste));
+    QVERIFY(extension->isActionEnabled("paste"));
+    QVERIFY(!extension->isActionEnabled("unknown"));
+    QVERIFY(!extension->isActionEnabled(-1));
+
+    Q_EMIT extension->setActionText("paste", QStringLiteral("Paste Image"));
+    QCOMPARE(extension->actionText(paste), QStringLiteral("Paste Image"));
+    QVERIFY(extension->actionText("copy").isNull());
+}
+
+void PartTest::testNavigationState()
+{
+    const QUrl url = QUrl::fromLocalFile(QFINDTESTDATA("notepad.desktop"));
+    TestPart part(nullptr, nullptr);
+    auto *extension = new KParts::NavigationExtension(&part);
+    KParts::OpenUrlArguments args;
+    args.metaData().insert(QStringLiteral("referrer"), QStringLiteral("https://kde.org"));
+    part.setArguments(args);
+    QVERIFY(part.openUrl(url));
+    extension->setContentCacheKey(QStringLiteral("cache-42"));
+    extension->setStateData(QStringLiteral("zoom"), QByteArray("150"));
+
+    QByteArray state;
+    {
+        QDataStream stream(&state, QIODevice::WriteOnly);
+        extension->saveState(stream);
+        stream << qint32(7); // data appended by a reimplementation
+    }
+
+    TestPart restoredPart(nullptr, nullptr);
+    auto *restoredExtension = new KParts::NavigationExtension(&restoredPart);
+    {
+        QDataStream stream(state);
+        restoredExtension->restoreState(stream);
+        qint32 extra = 0;
+        stream >> extra;
+        QCOMPARE(extra, 7);
+    }
+    QCOMPARE(restoredPart.url(), url);
+    QCOMPARE(restoredPart.arguments().mimeType(), part.arguments().mimeType());
+    QCOMPARE(restoredPart.arguments().metaData().value(QStringLiteral("referrer")), QStringLiteral("https://kde.org"));
+    QCOMPARE(restoredExtension->contentCacheKey(), QStringLiteral("cache-42"));
+    QCOMPARE(restoredExtension->stateData(QStringLiteral("zoom")), QByteArray("150"));
+
+    // The format used before 6.30
+    QByteArray legacyState;
+    {
+        QDataStream stream(&legacyState, QIODevice::WriteOnly);
+        stream << url << qint32(0) << qint32(20);
+    }
+    TestPart legacyPart(nullptr, nullptr);
+    auto *legacyExtension = new KParts::NavigationExtension(&legacyPart);
+    QDataStream legacyStream(legacyState);
+    legacyExtension->restoreState(legacyStream);
+    QCOMPARE(legacyPart.url(), url);
+    QCOMPARE(legacyPart.arguments().yOffset(), 20);
+    QVERIFY(legacyExtension->stateData(QStringLiteral("zoom")).isNull());
+
+    // A legacy state without a URL still starts with a length marker, not the magic value
+    QByteArray nullUrlState;
+    {
+        QDataStream stream(&nullUrlState, QIODevice::WriteOnly);
+        stream << QUrl() << qint32(0) << qint32(30);
+    }
+    TestPart nullUrlPart(nullptr, nullptr);
+    auto *nullUrlExtension = new KParts::NavigationExtension(&nullUrlPart);
+    QDataStream nullUrlStream(nullUrlState);
+    nullUrlExtension->restoreState(nullUrlStream);
+    QCOMPARE(nullUrlStream.status(), QDataStream::Ok);
+    QVERIFY(nullUrlStream.atEnd());
+    QCOMPARE(nullUrlPart.arguments().yOffset(), 30);
+}
+
+void PartTest::testDeferredRestore()
+{
+    const QUrl url = QUrl::fromLocalFile(QFINDTESTDATA("notepad.desktop"));
+    QByteArray state;
+    {
+        TestPart part(nullptr, nullptr);
+        auto *extension = new KParts::NavigationExtension(&part);
+        QVERIFY(part.openUrl(url));
+        QDataStream stream(&state, QIODevice::WriteOnly);
+        extension->saveState(stream);
+    }
+
+    QWidget window;
+    KParts::PartManager manager(&window);
+    QList<TestPart *> parts;
+    for (int i = 0; i < 3; ++i) {
+        auto *part = new TestPart(&manager, &window);
+        part->widget()->hide();
+        auto *extension = new KParts::NavigationExtension(part);
+        extension->setDeferredRestore(true);
+        QDataStream stream(state);
+        extension->restoreState(stream);
+        QVERIFY(extension->isRestorePending());
+        QCOMPARE(extension->pendingRestoreUrl(), url);
+        QVERIFY(part->url().isEmpty());
+        manager.addPart(part, false);
+        parts.append(part);
+    }
+    window.show();
+
+    // By priority
+    manager.setRestorePriority(parts.at(2), 10);
+    QCOMPARE(manager.restorePendingParts(1), 1);
+    QCOMPARE(parts.at(2)->url(), url);
+    QVERIFY(parts.at(0)->url().isEmpty());
+
+    // On activation
+    manager.setActivePart(parts.at(1));
+    QCOMPARE(parts.at(1)->url(), url);
+
+    // When shown
+    parts.at(0)->widget()->show();
+    QTRY_COMPARE(parts.at(0)->url(), url);
+    QCOMPARE(manager.restorePendingParts(), 0);
+
+    // Opening another document cancels the pending restore
+    const QUrl otherUrl = QUrl::fromLocalFile(QFINDTESTDATA("notepadpart.rc"));
+    TestPart openedPart(nullptr, &window);
+    openedPart.widget()->hide();
+    auto *openedExtension = new KParts::NavigationExtension(&openedPart);
+    openedExtension->setDeferredRestore(true);
+    {
+        QDataStream stream(state);
+        openedExtension->restoreState(stream);
+    }
+    QVERIFY(openedPart.openUrl(otherUrl));
+    QVERIFY(!openedExtension->isRestorePending());
+    openedPart.widget()->show();
+    QCoreApplication::processEvents();
+    QCOMPARE(openedPart.url(), otherUrl);
+
+    // So does restoring again without deferring
+    TestPart restoredPart(nullptr, &window);
+    restoredPart.widget()->hide();
+    auto *restoredExtension = new KParts::NavigationExtension(&restoredPart);
+    restoredExtension->setDeferredRestore(true);
+    {
+        QDataStream stream(state);
+        restoredExtension->restoreState(stream);
+    }
+    QVERIFY(restoredExtension->isRestorePending());
+    restoredExtension->setDeferredRestore(false);
+    {
+        QDataStream stream(state);
+        restoredExtension->restoreState(stream);
+    }
+    QVERIFY(!restoredExtension->isRestorePending());
+    QCOMPARE(restoredPart.url(), url);
+}
+
 void PartTest::testShouldNotCrashAfterDelete()
 {
     TestPart *part = new TestPart(nullptr, nullptr);
@@ -277,4 +909,718 @@ void PartTest::testActivationEvent()
     delete part;
 }
 
+void PartTest::testPartManagerClickActivation()
+{
+    QWidget window;
+    KParts::PartManager manager(&window);
+    TestPart *part1 = new TestPart(nullptr, &window);
+    TestPart *part2 = new TestPart(nullptr, &window);
+    manager.addPart(part1, false);
+    manager.addPart(part2, false);
+    QVERIFY(!manager.activePart());
+
+    // Clicking a child widget activates the part owning its nearest ancestor
+    QWidget *child = new QWidget(part2->widget());
+    QTest::mouseClick(child, Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part2);
+    QTest::mouseClick(part1->widget(), Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part1);
+
+    // Moving a widget to another part is noticed even after repeated clicks
+    QTest::mouseClick(child, Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part2);
+    child->setParent(part1->widget());
+    QTest::mouseClick(child, Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part1);
+    child->setParent(part2->widget());
+    QTest::mouseClick(child, Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part2);
+    QTest::mouseClick(part1->widget(), Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part1);
+
+    // A click missed by hitTest() doesn't stop the next one
+    part2->m_declineHitTest = true;
+    QTest::mouseClick(child, Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part1);
+    part2->m_declineHitTest = false;
+    QTest::mouseClick(child, Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part2);
+
+    // hitTest() may claim a widget of another part
+    child->setParent(part1->widget());
+    QTest::mouseClick(child, Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part1);
+    part2->m_claimedWidget = child;
+    QTest::mouseClick(child, Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part2);
+    part2->m_claimedWidget = nullptr;
+    child->setParent(part2->widget());
+
+    // Focus changes follow reparented widgets too
+    QFocusEvent focusIn(QEvent::FocusIn, Qt::MouseFocusReason);
+    QApplication::sendEvent(child, &focusIn);
+    QCOMPARE(manager.activePart(), part2);
+    child->setParent(part1->widget());
+    QApplication::sendEvent(child, &focusIn);
+    QCOMPARE(manager.activePart(), part1);
+    child->setParent(part2->widget());
+    QApplication::sendEvent(child, &focusIn);
+    QCOMPARE(manager.activePart(), part2);
+    // Also when the widget moved is further up, between the focused widget and the part widget
+    QWidget *container = new QWidget(part2->widget());
+    QWidget *inner = new QWidget(container);
+    QApplication::sendEvent(inner, &focusIn);
+    QCOMPARE(manager.activePart(), part2);
+    container->setParent(part1->widget());
+    QApplication::sendEvent(inner, &focusIn);
+    QCOMPARE(manager.activePart(), part1);
+    delete container;
+    QTest::mouseClick(part1->widget(), Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part1);
+
+    // The manager follows widget changes
+    part2->setWidget(new QWidget(&window));
+    QTest::mouseClick(child, Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part1);
+    QTest::mouseClick(part2->widget(), Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part2);
+
+    // Removed parts aren't activated anymore
+    manager.removePart(part1);
+    QTest::mouseClick(part1->widget(), Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part2);
+
+    delete part1;
+    delete part2;
+}
+
+// Records the parts going through the virtual registration methods
+class RecordingPartManager : public KParts::PartManager
+{
+public:
+    using KParts::PartManager::PartManager;
+
+    void addPart(KParts::Part *part, bool setActive = true) override
+    {
+        m_addedParts.append(part);
+        KParts::PartManager::addPart(part, setActive);
+    }
+    void removePart(KParts::Part *part) override
+    {
+        m_removedParts.append(part);
+        KParts::PartManager::removePart(part);
+    }
+
+    QList<KParts::Part *> m_addedParts;
+    QList<KParts::Part *> m_removedParts;
+};
+
+void PartTest::testPartManagerBatchRegistration()
+{
+    QWidget window;
+    RecordingPartManager manager(&window);
+    QSignalSpy addedSpy(&manager, &KParts::PartManager::partAdded);
+    QSignalSpy removedSpy(&manager, &KParts::PartManager::partRemoved);
+    QSignalSpy activeSpy(&manager, &KParts::PartManager::activePartChanged);
+
+    const QList<KParts::Part *> parts = {new TestPart(nullptr, &window), new TestPart(nullptr, &window), new TestPart(nullptr, &window)};
+    manager.addParts(parts, parts.at(1));
+    QCOMPARE(manager.parts(), parts);
+    QCOMPARE(manager.m_addedParts, parts);
+    QCOMPARE(addedSpy.count(), 3);
+    QCOMPARE(activeSpy.count(), 1);
+    QCOMPARE(manager.activePart(), parts.at(1));
+    for (KParts::Part *part : parts) {
+        QCOMPARE(part->manager(), &manager);
+    }
+
+    // Parts already managed are skipped
+    manager.addParts({parts.at(0)});
+    QCOMPARE(manager.parts().count(), 3);
+    QCOMPARE(addedSpy.count(), 3);
+
+    manager.removeParts({parts.at(1), parts.at(2)});
+    QCOMPARE(manager.parts(), QList<KParts::Part *>{parts.at(0)});
+    QCOMPARE(manager.m_removedParts, (QList<KParts::Part *>{parts.at(1), parts.at(2)}));
+    QCOMPARE(removedSpy.count(), 2);
+    QCOMPARE(activeSpy.count(), 2);
+    QVERIFY(!manager.activePart());
+    QVERIFY(!parts.at(1)->manager());
+
+    qDeleteAll(parts);
+    QVERIFY(manager.parts().isEmpty());
+}
+
+void PartTest::testPartManagerSharedDispatcher()
+{
+    QWidget window;
+    QPointer<KParts::PartManager> manager1 = new KParts::PartManager(&window);
+    manager1->setEventDispatchMode(KParts::PartManager::SharedDispatcher);
+    KParts::PartManager manager2(&window);
+    manager2.setEventDispatchMode(KParts::PartManager::SharedDispatcher);
+    TestPart *part1 = new TestPart(nullptr, &window);
+    TestPart *part2 = new TestPart(nullptr, &window);
+    manager1->addPart(part1, false);
+    manager2.addPart(part2, false);
+
+    // Each manager activates its own parts
+    QTest::mouseClick(part1->widget(), Qt::LeftButton);
+    QCOMPARE(manager1->activePart(), part1);
+    QTest::mouseClick(part2->widget(), Qt::LeftButton);
+    QCOMPARE(manager2.activePart(), part2);
+    QCOMPARE(manager1->activePart(), part1);
+    manager2.setActivePart(nullptr);
+
+    // A manager deleted while another one handles the event doesn't get it anymore
+    connect(&manager2, &KParts::PartManager::activePartChanged, manager1.data(), [&manager1]() {
+        delete manager1.data();
+    });
+    QTest::mouseClick(part2->widget(), Qt::LeftButton);
+    QVERIFY(!manager1);
+    QCOMPARE(manager2.activePart(), part2);
+
+    delete part1;
+    delete part2;
+}
+
+void PartTest::testPartManagerCoalescedActivation()
+{
+    QWidget window;
+    KParts::PartManager manager(&window);
+    manager.setActivationPolicy(KParts::PartManager::CoalescedActivation);
+    TestPart *part1 = new TestPart(nullptr, &window);
+    TestPart *part2 = new TestPart(nullptr, &window);
+    TestPart *part3 = new TestPart(nullptr, &window);
+    manager.addParts({part1, part2, part3});
+    QSignalSpy activeSpy(&manager, &KParts::PartManager::activePartChanged);
+
+    // Only the last request of an event loop iteration is carried out
+    manager.setActivePart(part1);
+    manager.setActivePart(part2);
+    manager.setActivePart(part3);
+    QVERIFY(manager.hasPendingActivation());
+    QVERIFY(!manager.activePart());
+    QTRY_VERIFY(!manager.hasPendingActivation());
+    QCOMPARE(activeSpy.count(), 1);
+    QCOMPARE(manager.activePart(), part3);
+
+    // Going back to the active part cancels the switch
+    manager.setActivePart(part1);
+    manager.setActivePart(part3);
+    manager.flushPendingActivation();
+    QCOMPARE(activeSpy.count(), 1);
+    QCOMPARE(manager.activePart(), part3);
+
+    // Removed parts are not activated
+    manager.setActivePart(part1);
+    manager.removePart(part1);
+    manager.flushPendingActivation();
+    QCOMPARE(manager.activePart(), part3);
+
+    // Deactivation happens right away
+    manager.setActivePart(part2);
+    manager.setActivePart(nullptr);
+    QVERIFY(!manager.hasPendingActivation());
+    QVERIFY(!manager.activePart());
+    QCOMPARE(activeSpy.count(), 2);
+
+    delete part1;
+    delete part2;
+    delete part3;
+}
+
+void PartTest::testPartManagerNestedParts()
+{
+    QWidget window;
+    KParts::PartManager manager(&window);
+    TestPart *top = new TestPart(nullptr, &window);
+    TestPart *child = new TestPart(top, &window);
+    TestPart *grandChild = new TestPart(child, &window);
+    TestPart *other = new TestPart(nullptr, &window);
+    manager.addParts({top, child, grandChild, other});
+
+    QCOMPARE(manager.topLevelPart(grandChild), top);
+    QCOMPARE(manager.topLevelPart(other), other);
+    QCOMPARE(manager.childParts(top), QList<KParts::Part *>{child});
+    QCOMPARE(manager.subtree(top), (QList<KParts::Part *>{top, child, grandChild}));
+
+    // Unless nested parts are allowed, the top-level part is activated instead
+    manager.setActivePart(grandChild);
+    QCOMPARE(manager.activePart(), top);
+    manager.setAllowNestedParts(true);
+    manager.setActivePart(grandChild);
+    QCOMPARE(manager.activePart(), grandChild);
+
+    manager.deactivateSubtree(child);
+    QVERIFY(!manager.activePart());
+
+    manager.removeSubtree(child);
+    QCOMPARE(manager.parts(), (QList<KParts::Part *>{top, other}));
+    QVERIFY(manager.childParts(top).isEmpty());
+    QVERIFY(!manager.topLevelPart(grandChild));
+
+    // Removing a part unlinks the parts nested in it, adding it again links them again
+    TestPart *nested = new TestPart(top, &window);
+    manager.addPart(nested, false);
+    QCOMPARE(manager.childParts(top), QList<KParts::Part *>{nested});
+    manager.removePart(top);
+    QVERIFY(manager.childParts(top).isEmpty());
+    QCOMPARE(manager.topLevelPart(nested), nested);
+    manager.setAllowNestedParts(false);
+    manager.setActivePart(nested); // still nested in a part which isn't managed
+    QVERIFY(!manager.activePart());
+    manager.addPart(top, false);
+    QCOMPARE(manager.childParts(top), QList<KParts::Part *>{nested});
+    QCOMPARE(manager.topLevelPart(nested), top);
+
+    delete other;
+    delete top; // and the parts nested in it
+}
+
+void PartTest::testPartManagerActivePartPerWindow()
+{
+    QWidget window1;
+    QWidget window2;
+    KParts::PartManager manager(&window1);
+    manager.addManagedTopLevelWidget(&window2);
+    manager.setActivePartPerWindow(true);
+    TestPart *part1 = new TestPart(nullptr, &window1);
+    TestPart *part2 = new TestPart(nullptr, &window2);
+    TestPart *part3 = new TestPart(nullptr, &window2);
+    manager.addParts({part1, part2, part3});
+    QList<QPair<const QWidget *, KParts::Part *>> changes;
+    connect(&manager, &KParts::PartManager::windowActivePartChanged, this, [&changes](const QWidget *window, KParts::Part *part) {
+        changes.append({window, part});
+    });
+
+    // Activating a part in the other window keeps the first one active
+    QTest::mouseClick(part1->widget(), Qt::LeftButton);
+    QTest::mouseClick(part2->widget(), Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part2);
+    QCOMPARE(manager.windowActivePart(&window1), part1);
+    QCOMPARE(manager.windowActivePart(&window2), part2);
+    QCOMPARE(changes.count(), 2);
+
+    // Going back to the first window doesn't change its active part
+    QTest::mouseClick(part1->widget(), Qt::LeftButton);
+    QCOMPARE(manager.activePart(), part1);
+    QCOMPARE(changes.count(), 2);
+
+    manager.setActivePart(part3);
+    QCOMPARE(manager.windowActivePart(&window1), part1);
+    QCOMPARE(manager.windowActivePart(&window2), part3);
+    QCOMPARE(changes.last(), (QPair<const QWidget *, KParts::Part *>(&window2, part3)));
+
+    // Removing a part active in a window which isn't the current one
+    manager.removePart(part1);
+    QVERIFY(!manager.windowActivePart(&window1));
+    QCOMPARE(manager.activePart(), part3);
+    QCOMPARE(changes.last(), (QPair<const QWidget *, KParts::Part *>(&window1, nullptr)));
+
+    // A part outside the managed windows takes the place of the current part in its window
+    TestPart *floating = new TestPart(nullptr, nullptr);
+    manager.addPart(floating, false);
+    manager.setActivePart(floating);
+    QCOMPARE(manager.activePart(), floating);
+    QVERIFY(floating->m_activated);
+    QVERIFY(!part3->m_activated);
+    QVERIFY(!manager.windowActivePart(&window2));
+    QCOMPARE(changes.last(), (QPair<const QWidget *, KParts::Part *>(&window2, nullptr)));
+    manager.setActivePart(part2);
+    QCOMPARE(manager.windowActivePart(&window2), part2);
+    QVERIFY(!floating->m_activated);
+
+    delete floating;
+    delete part1;
+    delete part2;
+    delete part3;
+}
+
+void PartTest::testPartManagerSuspension()
+{
+    QWidget window;
+    KParts::PartManager manager(&window);
+    TestPart *part1 = new TestPart(nullptr, &window);
+    TestPart *part2 = new TestPart(nullptr, &window);
+    TestPart *part3 = new TestPart(nullptr, &window);
+    manager.addParts({part1, part2, part3});
+    manager.setActivePart(part1);
+    manager.setActivePart(part2);
+
+    // part3 was never active, part1 was active before part2
+    QCOMPARE(manager.suspendLeastRecentlyUsedParts(1), 1);
+    QVERIFY(part3->m_suspended);
+    QVERIFY(manager.isPartSuspended(part3));
+    QVERIFY(!part1->m_suspended);
+
+    // The active part is never suspended
+    QCOMPARE(manager.suspendLeastRecentlyUsedParts(10), 1);
+    QVERIFY(part1->m_suspended);
+    QVERIFY(!part2->m_suspended);
+
+    // Activation resumes
+    manager.setActivePart(part3);
+    QVERIFY(!part3->m_suspended);
+    QVERIFY(!manager.isPartSuspended(part3));
+
+    // Inactive parts are suspended after the timeout
+    manager.setActivePart(part1);
+    QVERIFY(!part1->m_suspended);
+    manager.setSuspendTimeout(0);
+    QTRY_VERIFY(part2->m_suspended && part3->m_suspended);
+    QVERIFY(!part1->m_suspended);
+
+    delete part1;
+    delete part2;
+    delete part3;
+}
+
+// Clicks the button showing \a item in the message box opened next
+static void answerMessageBox(const KGuiItem &item)
+{
+    QTimer::singleShot(0, [item]() {
+        QWidget *dialog = QApplication::activeModalWidget();
+        QVERIFY(dialog);
+        const QList<QPushButton *> buttons = dialog->findChildren<QPushButton *>();
+        for (QPushButton *button : buttons) {
+            if (button->text().remove(QLatin1Char('&')) == item.plainText()) {
+                button->click();
+                return;
+            }
+        }
+        QFAIL("button not found");
+    });
+}
+
+void PartTest::testRecoveryJournal()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("journaled.txt"));
+    {
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("initial");
+    }
+    const QUrl url = QUrl::fromLocalFile(fileName);
+    KParts::ReadWritePart::removeRecoveryJournal(url);
+
+    TestReadWritePart *part = new TestReadWritePart(nullptr, nullptr);
+    QVERIFY(!part->appendToRecoveryJournal("ignored")); // disabled by default
+    part->setRecoveryJournalEnabled(true);
+    QVERIFY(part->openUrl(url));
+    QCOMPARE(part->m_data, QByteArray("initial"));
+    QVERIFY(!KParts::ReadWritePart::hasRecoveryJournal(url));
+
+    part->m_data += "+one+two";
+    part->setModified(true);
+    QVERIFY(part->appendToRecoveryJournal("+one"));
+    QVERIFY(part->appendToRecoveryJournal("+two"));
+    QVERIFY(KParts::ReadWritePart::hasRecoveryJournal(url));
+
+    QByteArray snapshot;
+    QList<QByteArray> operations;
+    QVERIFY(KParts::ReadWritePart::readRecoveryJournal(url, &snapshot, &operations));
+    QVERIFY(snapshot.isNull());
+    QCOMPARE(operations, (QList<QByteArray>{"+one", "+two"}));
+
+    // A snapshot replaces the operations recorded so far
+    QVERIFY(part->writeRecoverySnapshot(part->m_data));
+    part->m_data += "+three";
+    QVERIFY(part->appendToRecoveryJournal("+three"));
+    QVERIFY(KParts::ReadWritePart::readRecoveryJournal(url, &snapshot, &operations));
+    QCOMPARE(snapshot, QByteArray("initial+one+two"));
+    QCOMPARE(operations, (QList<QByteArray>{"+three"}));
+
+    // Saving the document removes the journal
+    QVERIFY(part->save());
+    QVERIFY(!part->isModified());
+    QVERIFY(!KParts::ReadWritePart::hasRecoveryJournal(url));
+    QVERIFY(!KParts::ReadWritePart::readRecoveryJournal(url, &snapshot, &operations));
+
+    // So does closing it without saving
+    part->setModified(true);
+    QVERIFY(part->appendToRecoveryJournal("+four"));
+    QVERIFY(KParts::ReadWritePart::hasRecoveryJournal(url));
+    QVERIFY(part->closeUrl(false));
+    QVERIFY(!KParts::ReadWritePart::hasRecoveryJournal(url));
+
+    // Or discarding the changes in queryClose(), the host may delete the part right away
+    QVERIFY(part->openUrl(url));
+    part->setModified(true);
+    QVERIFY(part->appendToRecoveryJournal("+discarded"));
+    answerMessageBox(KStandardGuiItem::discard());
+    QVERIFY(part->queryClose());
+    QVERIFY(!KParts::ReadWritePart::hasRecoveryJournal(url));
+    part->setModified(false);
+
+    // The journal of a crashed session is kept until the application removes it
+    QVERIFY(part->openUrl(url));
+    part->setModified(true);
+    QVERIFY(part->appendToRecoveryJournal("+five"));
+    delete part;
+    part = new TestReadWritePart(nullptr, nullptr);
+    part->setRecoveryJournalEnabled(true);
+    QVERIFY(part->openUrl(url));
+    QVERIFY(KParts::ReadWritePart::hasRecoveryJournal(url));
+    part->setModified(true);
+    QVERIFY(!part->appendToRecoveryJournal("+six"));
+    QVERIFY(!part->writeRecoverySnapshot(part->m_data));
+    QVERIFY(KParts::ReadWritePart::readRecoveryJournal(url, &snapshot, &operations));
+    QCOMPARE(operations, (QList<QByteArray>{"+five"}));
+    KParts::ReadWritePart::removeRecoveryJournal(url);
+    QVERIFY(part->appendToRecoveryJournal("+six"));
+    QVERIFY(part->closeUrl(false));
+    QVERIFY(!KParts::ReadWritePart::hasRecoveryJournal(url));
+
+    delete part;
+}
+
+#ifdef Q_OS_LINUX
+// Counts the files created, deleted or renamed in a directory, as reported by inotify
+class DirectoryEntryCounter
+{
+public:
+    explicit DirectoryEntryCounter(const QString &path)
+        : m_fd(inotify_init1(IN_NONBLOCK))
+    {
+        if (m_fd >= 0) {
+            inotify_add_watch(m_fd, QFile::encodeName(path).constData(), IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+        }
+    }
+    ~DirectoryEntryCounter()
+    {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+    }
+    bool isValid() const
+    {
+        return m_fd >= 0;
+    }
+    int count() const
+    {
+        int count = 0;
+        alignas(struct inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = ::read(m_fd, buffer, sizeof(buffer))) > 0) {
+            for (ssize_t offset = 0; offset < length;) {
+                const auto *event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+                ++count;
+                offset += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        return count;
+    }
+
+private:
+    const int m_fd;
+};
+#endif
+
+void PartTest::testRemoteSaveStaging()
+{
+    TestReadWritePart *part = new TestReadWritePart(nullptr, nullptr);
+    // No worker exists for this scheme, so every upload fails
+    part->setUrl(QUrl(QStringLiteral("kpartstest://localhost/remote.txt")));
+    part->m_data = "remote";
+
+    QVERIFY(part->save());
+    const QString stagingFile = part->localFilePath();
+    QVERIFY(!stagingFile.isEmpty());
+    QVERIFY(QFile::exists(stagingFile));
+    const QDir stagingDir = QFileInfo(stagingFile).dir();
+    const QString uploadFile = stagingDir.filePath(QStringLiteral("upload"));
+    // The upload job gets a second link to the document, not a copy, and no other file is created
+    QCOMPARE(stagingDir.entryList(QDir::Files), (QStringList{QStringLiteral("document"), QStringLiteral("upload")}));
+#ifdef Q_OS_UNIX
+    QT_STATBUF documentStat;
+    QT_STATBUF uploadStat;
+    QCOMPARE(QT_STAT(QFile::encodeName(stagingFile).constData(), &documentStat), 0);
+    QCOMPARE(QT_STAT(QFile::encodeName(uploadFile).constData(), &uploadStat), 0);
+    QCOMPARE(uploadStat.st_ino, documentStat.st_ino);
+    QCOMPARE(int(documentStat.st_nlink), 2);
+#endif
+    QVERIFY(!part->waitSaveComplete());
+    QVERIFY(!QFile::exists(uploadFile));
+    QCOMPARE(stagingDir.entryList(QDir::Files), QStringList{QStringLiteral("document")});
+
+    // Saving again writes to the same local file, rewritten in place
+#ifdef Q_OS_LINUX
+    DirectoryEntryCounter entryCounter(stagingDir.path());
+    QVERIFY(entryCounter.isValid());
+#endif
+    QVERIFY(part->save());
+    QCOMPARE(part->localFilePath(), stagingFile);
+#ifdef Q_OS_UNIX
+    QT_STATBUF resavedStat;
+    QCOMPARE(QT_STAT(QFile::encodeName(stagingFile).constData(), &resavedStat), 0);
+    QCOMPARE(resavedStat.st_ino, documentStat.st_ino);
+#endif
+    QCOMPARE(stagingDir.entryList(QDir::Files).count(), 2);
+    QVERIFY(!part->waitSaveComplete());
+#ifdef Q_OS_LINUX
+    // Linking "upload", and removing it once the upload failed: no other file is created or deleted
+    QCOMPARE(entryCounter.count(), 2);
+#endif
+
+    // A stale link left behind by an interrupted upload doesn't break saving
+    QFile staleFile(uploadFile);
+    QVERIFY(staleFile.open(QIODevice::WriteOnly));
+    staleFile.close();
+    QVERIFY(part->save());
+    QCOMPARE(part->localFilePath(), stagingFile);
+    QVERIFY(!part->waitSaveComplete());
+
+    delete part;
+    QVERIFY(!QFile::exists(stagingFile));
+
+#ifdef Q_OS_UNIX
+    // Without a staging directory the save fails with an error, rather than writing nowhere
+    TestReadWritePart unstagedPart(nullptr, nullptr);
+    unstagedPart.setUrl(QUrl(QStringLiteral("kpartstest://localhost/unstaged.txt")));
+    QSignalSpy canceledSpy(&unstagedPart, &KParts::ReadWritePart::canceled);
+    const QByteArray tmpDir = qgetenv("TMPDIR");
+    qputenv("TMPDIR", "/nonexistent-kparts-test-dir");
+    QVERIFY(!unstagedPart.save());
+    if (tmpDir.isNull()) {
+        qunsetenv("TMPDIR");
+    } else {
+        qputenv("TMPDIR", tmpDir);
+    }
+    QCOMPARE(canceledSpy.count(), 1);
+    QVERIFY(!canceledSpy.at(0).at(0).toString().isEmpty());
+    QVERIFY(unstagedPart.localFilePath().isEmpty());
+    // The next save tries again
+    QVERIFY(unstagedPart.save());
+    QVERIFY(!unstagedPart.localFilePath().isEmpty());
+    QVERIFY(!unstagedPart.waitSaveComplete());
+#endif
+}
+
+void PartTest::testSaveAsCopy()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("original.txt"));
+    {
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("original");
+    }
+    auto fileContents = [&dir](const QString &name) {
+        QFile file(dir.filePath(name));
+        return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+    };
+
+    TestReadWritePart *part = new TestReadWritePart(nullptr, nullptr);
+    QVERIFY(!part->isSaveAsCopyEnabled());
+    QVERIFY(part->openUrl(QUrl::fromLocalFile(fileName)));
+
+    // saveFile() is called unless the part opts in, even for an unmodified document
+    part->m_data = "serialized";
+    QVERIFY(part->saveAs(QUrl::fromLocalFile(dir.filePath(QStringLiteral("copy1.txt")))));
+    QCOMPARE(fileContents(QStringLiteral("copy1.txt")), QByteArray("serialized"));
+
+    // Once enabled, the local file of the unmodified document is copied
+    part->setSaveAsCopyEnabled(true);
+    part->m_data = "ignored";
+    QVERIFY(part->saveAs(QUrl::fromLocalFile(dir.filePath(QStringLiteral("copy2.txt")))));
+    QCOMPARE(fileContents(QStringLiteral("copy2.txt")), QByteArray("serialized"));
+    QCOMPARE(part->url(), QUrl::fromLocalFile(dir.filePath(QStringLiteral("copy2.txt"))));
+
+    // But not for a modified document, nor for another file type
+    part->m_data = "modified";
+    part->setModified(true);
+    QVERIFY(part->saveAs(QUrl::fromLocalFile(dir.filePath(QStringLiteral("copy3.txt")))));
+    QCOMPARE(fileContents(QStringLiteral("copy3.txt")), QByteArray("modified"));
+    QVERIFY(!part->isModified());
+    part->m_data = "converted";
+    QVERIFY(part->saveAs(QUrl::fromLocalFile(dir.filePath(QStringLiteral("copy4.html")))));
+    QCOMPARE(fileContents(QStringLiteral("copy4.html")), QByteArray("converted"));
+
+    delete part;
+}
+
+void PartTest::testQueryCloseParts()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    KParts::MainWindow window;
+    QList<KParts::Part *> parts;
+    QList<TestReadWritePart *> rwParts;
+    QList<int> queryCloseCounts(3, 0);
+    for (int i = 0; i < 3; ++i) {
+        const QString fileName = dir.filePath(QStringLiteral("doc%1.txt").arg(i));
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("initial");
+        file.close();
+
+        TestReadWritePart *part = new TestReadWritePart(nullptr, nullptr);
+        QVERIFY(part->openUrl(QUrl::fromLocalFile(fileName)));
+        connect(part, &KParts::ReadWritePart::sigQueryClose, this, [&queryCloseCounts, i]() {
+            ++queryCloseCounts[i];
+        });
+        parts.append(part);
+        rwParts.append(part);
+    }
+    auto fileContents = [&dir](int i) {
+        QFile file(dir.filePath(QStringLiteral("doc%1.txt").arg(i)));
+        return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+    };
+
+    // Nothing to ask when no document is modified
+    QVERIFY(window.queryCloseParts(parts));
+
+    // Discarding doesn't save anything
+    rwParts[0]->m_data = "discarded";
+    rwParts[0]->setModified(true);
+    answerMessageBox(KStandardGuiItem::discard());
+    QVERIFY(window.queryCloseParts(parts));
+    QCOMPARE(fileContents(0), QByteArray("initial"));
+    QVERIFY(rwParts[0]->isModified());
+
+    // Saving goes through answerQueryClose() of the modified parts only
+    rwParts[0]->m_data = "saved0";
+    rwParts[2]->m_data = "saved2";
+    rwParts[2]->setModified(true);
+    answerMessageBox(KStandardGuiItem::save());
+    QVERIFY(window.queryCloseParts(parts));
+    QCOMPARE(queryCloseCounts, (QList<int>{1, 0, 1}));
+    QCOMPARE(fileContents(0), QByteArray("saved0"));
+    QCOMPARE(fileContents(1), QByteArray("initial"));
+    QCOMPARE(fileContents(2), QByteArray("saved2"));
+    QVERIFY(!rwParts[0]->isModified());
+    QVERIFY(!rwParts[2]->isModified());
+
+    // A sigQueryClose() handler aborting closing stops the remaining saves
+    connect(rwParts[0], &KParts::ReadWritePart::sigQueryClose, this, [](bool *handled, bool *abortClosing) {
+        *handled = true;
+        *abortClosing = true;
+    });
+    rwParts[0]->m_data = "aborted0";
+    rwParts[0]->setModified(true);
+    rwParts[2]->m_data = "aborted2";
+    rwParts[2]->setModified(true);
+    answerMessageBox(KStandardGuiItem::save());
+    QVERIFY(!window.queryCloseParts(parts));
+    QCOMPARE(queryCloseCounts, (QList<int>{2, 0, 1}));
+    QCOMPARE(fileContents(0), QByteArray("saved0"));
+    QCOMPARE(fileContents(2), QByteArray("saved2"));
+    QVERIFY(rwParts[0]->isModified());
+    QVERIFY(rwParts[2]->isModified());
+
+    // Nothing is left behind for a later queryClose(), which asks again
+    answerMessageBox(KStandardGuiItem::cancel());
+    QVERIFY(!rwParts[2]->queryClose());
+    QCOMPARE(fileContents(2), QByteArray("saved2"));
+
+    for (TestReadWritePart *part : std::as_const(rwParts)) {
+        part->setModified(false);
+        delete part;
+    }
+}
+
 #include "moc_parttest.cpp"
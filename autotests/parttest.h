@@ -13,6 +13,8 @@ class PartTest : public QObject
 {
     Q_OBJECT
 private Q_SLOTS:
+    void initTestCase();
+
     void testAutoDeletePart();
     void testAutoDeleteWidget();
     void testNoAutoDeletePart();
@@ -23,8 +25,31 @@ private Q_SLOTS:
     void testEmptyUrlAfterCloseUrl();
 
     void testToolbarVisibility();
+    void testIncrementalGUIMerge();
+    void testGUIMergeStatistics();
+    void testToolBarConfig();
+    void testSharedGUIDocument();
+    void testLazyShellGUI();
+    void testShortcutIndex();
+    void testPreparedGUI();
+    void testNavigationRequestQueue();
+    void testNavigationActionStatus();
+    void testNavigationState();
+    void testDeferredRestore();
     void testShouldNotCrashAfterDelete();
     void testActivationEvent();
+    void testPartManagerClickActivation();
+    void testPartManagerBatchRegistration();
+    void testPartManagerSharedDispatcher();
+    void testPartManagerCoalescedActivation();
+    void testPartManagerNestedParts();
+    void testPartManagerActivePartPerWindow();
+    void testPartManagerSuspension();
+
+    void testRecoveryJournal();
+    void testRemoteSaveStaging();
+    void testSaveAsCopy();
+    void testQueryCloseParts();
 };
 
 #endif /* PARTTEST_H */
@@ -0,0 +1,247 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include <KParts/PartLoader>
+#include <KParts/ReadWritePart>
+#include <QTest>
+
+#include <KPluginMetaData>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QWidget>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+/*
+ * Measures the save paths of ReadWritePart with the notepad test part.
+ *
+ * Remote URLs use the kpartsbench: scheme, served from local files by the
+ * kio_kpartsbench worker built next to this benchmark.
+ *
+ * Environment:
+ *   KPARTS_SAVEBENCH_MAX_MB     largest document size in MiB (default 16, up to 1024)
+ *   KPARTS_SAVEBENCH_ITERATIONS number of saves per row (default depends on the size)
+ */
+
+enum Scenario {
+    Save,
+    SaveAsLocal,
+    SaveAsLocalToRemote,
+    SaveAsRemoteToRemote,
+};
+Q_DECLARE_METATYPE(Scenario)
+
+static const qint64 s_sizes[] = {1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 256 * 1024 * 1024, 1024 * 1024 * 1024};
+
+// Downloading the largest documents through the worker takes a while
+static const int s_remoteTimeout = 10 * 60 * 1000;
+
+static QString formatSize(qint64 size)
+{
+    if (size >= 1024 * 1024) {
+        return QString::number(size / (1024 * 1024)) + QLatin1String("MB");
+    }
+    return QString::number(size / 1024) + QLatin1String("KB");
+}
+
+static QUrl remoteUrl(const QString &path)
+{
+    QUrl url;
+    url.setScheme(QStringLiteral("kpartsbench"));
+    url.setPath(path);
+    return url;
+}
+
+class SaveBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void benchmarkSave_data();
+    void benchmarkSave();
+
+private:
+    KParts::ReadWritePart *createPart();
+    bool openDocument(KParts::ReadWritePart *part, const QUrl &url);
+    QString sourceFile(qint64 size);
+
+    QTemporaryDir m_tempDir;
+    QWidget m_parentWidget;
+};
+
+void SaveBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    QVERIFY(m_tempDir.isValid());
+}
+
+void SaveBenchmark::benchmarkSave_data()
+{
+    QTest::addColumn<Scenario>("scenario");
+    QTest::addColumn<bool>("modified");
+    QTest::addColumn<qint64>("size");
+
+    bool ok;
+    qint64 maxSize = qEnvironmentVariableIntValue("KPARTS_SAVEBENCH_MAX_MB", &ok) * qint64(1024 * 1024);
+    if (!ok) {
+        maxSize = 16 * 1024 * 1024;
+    }
+
+    for (qint64 size : s_sizes) {
+        if (size > maxSize) {
+            break;
+        }
+        const QByteArray sizeName = formatSize(size).toLatin1();
+        QTest::addRow("save/%s", sizeName.constData()) << Save << true << size;
+        // Unmodified documents are copied instead of being written by the part, see createPart()
+        QTest::addRow("saveAs-local/%s", sizeName.constData()) << SaveAsLocal << true << size;
+        QTest::addRow("saveAs-local-unmodified/%s", sizeName.constData()) << SaveAsLocal << false << size;
+        QTest::addRow("saveAs-local-remote/%s", sizeName.constData()) << SaveAsLocalToRemote << true << size;
+        QTest::addRow("saveAs-local-remote-unmodified/%s", sizeName.constData()) << SaveAsLocalToRemote << false << size;
+        QTest::addRow("saveAs-remote-remote/%s", sizeName.constData()) << SaveAsRemoteToRemote << true << size;
+        QTest::addRow("saveAs-remote-remote-unmodified/%s", sizeName.constData()) << SaveAsRemoteToRemote << false << size;
+    }
+}
+
+void SaveBenchmark::benchmarkSave()
+{
+    QFETCH(Scenario, scenario);
+    QFETCH(bool, modified);
+    QFETCH(qint64, size);
+
+    bool ok;
+    int iterations = qEnvironmentVariableIntValue("KPARTS_SAVEBENCH_ITERATIONS", &ok);
+    if (!ok || iterations < 1) {
+        // Keep the total amount of data written per row around 64 MB
+        iterations = int(qBound(qint64(5), (64 * 1024 * 1024) / size, qint64(100)));
+    }
+
+    const QString source = sourceFile(size);
+    QVERIFY(!source.isEmpty());
+    const QString targets[] = {m_tempDir.filePath(QStringLiteral("target-a.txt")), m_tempDir.filePath(QStringLiteral("target-b.txt"))};
+
+    std::unique_ptr<KParts::ReadWritePart> part(createPart());
+    QVERIFY(part);
+    QVERIFY(openDocument(part.get(), scenario == SaveAsRemoteToRemote ? remoteUrl(source) : QUrl::fromLocalFile(source)));
+    if (scenario == Save) {
+        // Don't overwrite the shared source file
+        QVERIFY(part->saveAs(QUrl::fromLocalFile(targets[0])));
+        QVERIFY(part->waitSaveComplete());
+    }
+
+    QList<qint64> durations;
+    durations.reserve(iterations);
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; ++i) {
+        if (scenario == SaveAsLocalToRemote && i > 0) {
+            QVERIFY(openDocument(part.get(), QUrl::fromLocalFile(source)));
+        }
+        part->setModified(modified);
+
+        timer.start();
+        switch (scenario) {
+        case Save:
+            QVERIFY(part->save());
+            break;
+        case SaveAsLocal:
+            QVERIFY(part->saveAs(QUrl::fromLocalFile(targets[i % 2])));
+            break;
+        case SaveAsLocalToRemote:
+        case SaveAsRemoteToRemote:
+            QVERIFY(part->saveAs(remoteUrl(targets[i % 2])));
+            break;
+        }
+        QVERIFY(part->waitSaveComplete());
+        durations.append(timer.nsecsElapsed());
+    }
+
+    std::sort(durations.begin(), durations.end());
+    // Nearest-rank percentiles
+    const auto percentile = [&durations](int p) {
+        const int rank = int(std::ceil(p / 100.0 * durations.size()));
+        return durations.at(qMax(rank, 1) - 1) / 1e6;
+    };
+    const double p50 = percentile(50);
+    const double p99 = percentile(99);
+    const double throughput = (size / (1024.0 * 1024.0)) / (p50 / 1000.0);
+
+    qInfo().noquote() << QStringLiteral("%1: %2 saves, p50 %3 ms, p99 %4 ms, %5 MB/s")
+                             .arg(QString::fromLatin1(QTest::currentDataTag()))
+                             .arg(iterations)
+                             .arg(p50, 0, 'f', 3)
+                             .arg(p99, 0, 'f', 3)
+                             .arg(throughput, 0, 'f', 1);
+    QTest::setBenchmarkResult(p50, QTest::WalltimeMilliseconds);
+}
+
+KParts::ReadWritePart *SaveBenchmark::createPart()
+{
+    const KPluginMetaData md(QStringLiteral("kf6/parts/notepadpart"));
+    const auto result = KParts::PartLoader::instantiatePart<KParts::ReadWritePart>(md, &m_parentWidget, nullptr);
+    if (!result) {
+        qWarning() << result.errorString;
+        return nullptr;
+    }
+    // The notepad part writes the text as it was read, so a copy is the same document
+    result.plugin->setSaveAsCopyEnabled(true);
+    return result.plugin;
+}
+
+bool SaveBenchmark::openDocument(KParts::ReadWritePart *part, const QUrl &url)
+{
+    // Never ask whether to save the previous document
+    part->closeUrl(false);
+
+    QSignalSpy completedSpy(part, qOverload<>(&KParts::ReadOnlyPart::completed));
+    QSignalSpy canceledSpy(part, &KParts::ReadOnlyPart::canceled);
+    if (!part->openUrl(url)) {
+        return false;
+    }
+    if (!url.isLocalFile()) {
+        // Remote documents are downloaded asynchronously
+        if (!QTest::qWaitFor([&]() {
+                return completedSpy.count() + canceledSpy.count() > 0;
+            }, s_remoteTimeout)) {
+            return false;
+        }
+    }
+    return canceledSpy.isEmpty();
+}
+
+// Creates (once per size) a plain text document of the given size
+QString SaveBenchmark::sourceFile(qint64 size)
+{
+    const QString path = m_tempDir.filePath(QLatin1String("source-") + formatSize(size) + QLatin1String(".txt"));
+    if (QFile::exists(path)) {
+        return path;
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return QString();
+    }
+    const QByteArray line = QByteArray(63, 'x') + '\n';
+    QByteArray block;
+    block.reserve(1024 * 1024);
+    while (block.size() < 1024 * 1024) {
+        block += line;
+    }
+    for (qint64 written = 0; written < size; written += qMin(size - written, qint64(block.size()))) {
+        if (file.write(block.constData(), qMin(size - written, qint64(block.size()))) < 0) {
+            return QString();
+        }
+    }
+    return path;
+}
+
+QTEST_MAIN(SaveBenchmark)
+
+#include "savebenchmark.moc"
@@ -9,41 +9,507 @@
 #include "mainwindow.h"
 
 #include "guiactivateevent.h"
+#include "kparts_logging.h"
 #include "part.h"
+#include "partbase_p.h"
+#include "readwritepart.h"
 
 #include <KActionCollection>
 #include <KConfigGroup>
+#include <KEditToolBar>
 #include <KHelpMenu>
+#include <KLocalizedString>
+#include <KMessageBox>
 #include <KSharedConfig>
+#include <KToolBar>
 #include <KXMLGUIFactory>
 
 #include <QAction>
+#include <QActionGroup>
 #include <QApplication>
+#include <QDomDocument>
+#include <QElapsedTimer>
+#include <QFileDialog>
+#include <QHash>
+#include <QMenu>
+#include <QMenuBar>
 #include <QPointer>
 #include <QStatusBar>
+#include <QTimer>
+
+#include <algorithm>
+#include <optional>
 
 using namespace KParts;
 
 namespace KParts
 {
+// Measures the time from the end of a GUI merge to the next repaint of the window
+class RepaintWatcher : public QObject
+{
+public:
+    explicit RepaintWatcher(MainWindow::GUIMergeStatistics *statistics)
+        : m_statistics(statistics)
+    {
+    }
+
+    void watch(QWidget *window)
+    {
+        m_timer.start();
+        window->installEventFilter(this);
+    }
+
+    bool eventFilter(QObject *obj, QEvent *ev) override
+    {
+        if (ev->type() == QEvent::UpdateRequest) {
+            obj->removeEventFilter(this);
+            m_statistics->paintNsecs = m_timer.nsecsElapsed();
+            qCDebug(KPARTSLOG) << "Window repainted" << m_statistics->paintNsecs / 1000 << "us after the GUI merge";
+        }
+        return false;
+    }
+
+private:
+    MainWindow::GUIMergeStatistics *const m_statistics;
+    QElapsedTimer m_timer;
+};
+
+// Merges the help menu into a shell GUI that was built without it
+class HelpMenuClient : public KXMLGUIClient
+{
+public:
+    HelpMenuClient(KXMLGUIClient *shell, KHelpMenu *helpMenu)
+        : m_shell(shell)
+    {
+        // Same order and grouping as in ui_standards.rc
+        const QList<QList<KHelpMenu::MenuId>> groups = {
+            {KHelpMenu::menuHelpContents, KHelpMenu::menuWhatsThis},
+            {KHelpMenu::menuReportBug, KHelpMenu::menuDonate},
+            {KHelpMenu::menuSwitchLanguage},
+            {KHelpMenu::menuAboutApp, KHelpMenu::menuAboutKDE},
+        };
+        QString xml = QStringLiteral("<!DOCTYPE gui><gui name=\"kparts_helpmenu\"><MenuBar><Menu name=\"help\"><text>%1</text>")
+                          .arg(i18nc("@title:menu", "&Help").toHtmlEscaped());
+        bool separator = false;
+        for (const QList<KHelpMenu::MenuId> &group : groups) {
+            for (KHelpMenu::MenuId id : group) {
+                if (QAction *action = helpMenu->action(id)) {
+                    if (separator) {
+                        xml += QLatin1String("<Separator/>");
+                        separator = false;
+                    }
+                    xml += QStringLiteral("<Action name=\"%1\"/>").arg(action->objectName());
+                }
+            }
+            separator = !xml.endsWith(QLatin1String("</text>"));
+        }
+        xml += QLatin1String("</Menu></MenuBar></gui>");
+        setXML(xml);
+    }
+
+    // The actions are in the shell's collection, where the shortcuts dialog finds them
+    KActionCollection *actionCollection() const override
+    {
+        return m_shell->actionCollection();
+    }
+
+private:
+    KXMLGUIClient *const m_shell;
+};
+
 class MainWindowPrivate
 {
 public:
     MainWindowPrivate()
         : m_activePart(nullptr)
+        , m_repaintWatcher(&m_guiMergeStatistics)
     {
     }
     ~MainWindowPrivate()
     {
+        if (m_helpClient && m_helpClient->factory()) {
+            m_helpClient->factory()->removeClient(m_helpClient.get());
+        }
+        // The actions and parts may outlive us
+        for (const IndexedAction &entry : std::as_const(m_indexedActions)) {
+            QObject::disconnect(entry.changedConnection);
+            QObject::disconnect(entry.destroyedConnection);
+        }
+        for (const PreparedGUI &prepared : std::as_const(m_preparedGUIs)) {
+            releasePreparedGUI(prepared);
+        }
     }
 
     QPointer<Part> m_activePart;
     bool m_bShellGUIActivated = false;
     KHelpMenu *m_helpMenu = nullptr;
     bool m_manageWindowTitle = true;
+    int m_maxConcurrentSaves = 4;
+    MainWindow::GUIMergeStatistics m_guiMergeStatistics;
+    RepaintWatcher m_repaintWatcher;
+    bool m_lazyShellGUI = false;
+    bool m_shellGUIPending = false;
+    std::unique_ptr<HelpMenuClient> m_helpClient;
+
+    // The toolbars before the KEditToolBar dialog of configureToolbars() changed them
+    struct ToolBarSnapshot {
+        QPointer<KToolBar> toolBar;
+        QList<QAction *> actions;
+    };
+    QList<ToolBarSnapshot> m_toolBarSnapshot;
+    QPointer<KEditToolBar> m_toolBarEditor;
+
+    void snapshotToolBars(MainWindow *q)
+    {
+        m_toolBarSnapshot.clear();
+        const QList<KToolBar *> bars = q->toolBars();
+        for (KToolBar *toolBar : bars) {
+            m_toolBarSnapshot.append({toolBar, toolBar->actions()});
+        }
+    }
+
+    // Parts merged ahead of their activation, with what was hidden to keep them invisible
+    struct PreparedGUI {
+        // Hidden through the group, an action then keeps what setVisible() is called with meanwhile
+        QActionGroup *hidingGroup = nullptr;
+        // Actions of a group of their own, hidden one by one until they change
+        QList<QPointer<QAction>> hiddenActions;
+        QList<QMetaObject::Connection> visibilityConnections;
+        QList<QPointer<QWidget>> hiddenContainers;
+        QMetaObject::Connection destroyedConnection;
+    };
+    QHash<Part *, PreparedGUI> m_preparedGUIs;
+
+    void hideAction(Part *part, PreparedGUI *prepared, QAction *action)
+    {
+        if (!action->isVisible()) {
+            return;
+        }
+        if (!action->actionGroup()) {
+            prepared->hidingGroup->addAction(action);
+            return;
+        }
+        action->setVisible(false);
+        prepared->hiddenActions.append(action);
+        // The part showing or hiding the action meanwhile has the last word
+        prepared->visibilityConnections.append(QObject::connect(action, &QAction::visibleChanged, prepared->hidingGroup, [this, part, action]() {
+            const auto it = m_preparedGUIs.find(part);
+            if (it != m_preparedGUIs.end()) {
+                it->hiddenActions.removeOne(action);
+            }
+        }));
+    }
+
+    // Hides the visible actions of a client and its child clients
+    void hideActions(Part *part, PreparedGUI *prepared, KXMLGUIClient *client)
+    {
+        const QList<QAction *> actions = client->actionCollection()->actions();
+        for (QAction *action : actions) {
+            hideAction(part, prepared, action);
+        }
+        const QList<KXMLGUIClient *> children = client->childClients();
+        for (KXMLGUIClient *child : children) {
+            hideActions(part, prepared, child);
+        }
+    }
+
+    // Gives the actions back to the part, as they were before or as the part set them since
+    static void releasePreparedGUI(const PreparedGUI &prepared)
+    {
+        QObject::disconnect(prepared.destroyedConnection);
+        for (const QMetaObject::Connection &connection : prepared.visibilityConnections) {
+            QObject::disconnect(connection);
+        }
+        prepared.hidingGroup->setVisible(true);
+        const QList<QAction *> grouped = prepared.hidingGroup->actions();
+        for (QAction *action : grouped) {
+            prepared.hidingGroup->removeAction(action);
+        }
+        delete prepared.hidingGroup;
+    }
+
+    void revealPreparedGUI(Part *part)
+    {
+        const PreparedGUI prepared = m_preparedGUIs.take(part);
+        releasePreparedGUI(prepared);
+        for (QAction *action : prepared.hiddenActions) {
+            if (action) {
+                action->setVisible(true);
+            }
+        }
+        for (QWidget *container : prepared.hiddenContainers) {
+            if (container) {
+                container->show();
+            }
+        }
+    }
+
+    // Shortcut index of the enabled actions of the merged clients
+    struct IndexedAction {
+        QList<QKeySequence> shortcuts;
+        bool enabled;
+        QMetaObject::Connection changedConnection;
+        QMetaObject::Connection destroyedConnection;
+    };
+    QHash<QAction *, IndexedAction> m_indexedActions;
+    QHash<QKeySequence, QList<QAction *>> m_shortcutIndex;
+    QHash<const KXMLGUIClient *, QList<QPointer<QAction>>> m_clientActions;
+    // The actions a conflict was reported for, createGUI() indexes the same actions again on each switch
+    QHash<QKeySequence, QList<QAction *>> m_reportedConflicts;
+
+    // Only looks at the actions not indexed yet, e.g. those added since the last call
+    void indexClient(MainWindow *q, KXMLGUIClient *client)
+    {
+        QList<QPointer<QAction>> &indexed = m_clientActions[client];
+        const QList<QAction *> actions = client->actionCollection()->actions();
+        for (QAction *action : actions) {
+            if (!m_indexedActions.contains(action)) {
+                indexAction(q, action);
+                indexed.append(action);
+            }
+        }
+        const QList<KXMLGUIClient *> children = client->childClients();
+        for (KXMLGUIClient *child : children) {
+            indexClient(q, child);
+        }
+    }
+
+    void unindexClient(KXMLGUIClient *client)
+    {
+        const QList<QPointer<QAction>> indexed = m_clientActions.take(client);
+        for (QAction *action : indexed) {
+            if (action) {
+                unindexAction(action);
+            }
+        }
+        const QList<KXMLGUIClient *> children = client->childClients();
+        for (KXMLGUIClient *child : children) {
+            unindexClient(child);
+        }
+    }
+
+    void indexAction(MainWindow *q, QAction *action)
+    {
+        IndexedAction &entry = m_indexedActions[action];
+        entry.shortcuts = action->shortcuts();
+        entry.enabled = action->isEnabled();
+        entry.changedConnection = QObject::connect(action, &QAction::changed, q, [this, q, action]() {
+            // Also emitted for the text, icon...
+            auto it = m_indexedActions.find(action);
+            if (it == m_indexedActions.end() || (it->shortcuts == action->shortcuts() && it->enabled == action->isEnabled())) {
+                return;
+            }
+            if (it->enabled) {
+                removeShortcuts(action, it->shortcuts);
+            }
+            it->shortcuts = action->shortcuts();
+            it->enabled = action->isEnabled();
+            if (it->enabled) {
+                addShortcuts(q, action, it->shortcuts);
+            }
+        });
+        entry.destroyedConnection = QObject::connect(action, &QObject::destroyed, q, [this, action]() {
+            unindexAction(action);
+            for (QList<QAction *> &reported : m_reportedConflicts) {
+                reported.removeOne(action);
+            }
+        });
+        if (entry.enabled) {
+            addShortcuts(q, action, entry.shortcuts);
+        }
+    }
+
+    void unindexAction(QAction *action)
+    {
+        const auto it = m_indexedActions.constFind(action);
+        if (it == m_indexedActions.constEnd()) {
+            return;
+        }
+        QObject::disconnect(it->changedConnection);
+        QObject::disconnect(it->destroyedConnection);
+        if (it->enabled) {
+            removeShortcuts(action, it->shortcuts);
+        }
+        m_indexedActions.erase(it);
+    }
+
+    void addShortcuts(MainWindow *q, QAction *action, const QList<QKeySequence> &shortcuts)
+    {
+        for (const QKeySequence &sequence : shortcuts) {
+            if (sequence.isEmpty()) {
+                continue;
+            }
+            QList<QAction *> &actions = m_shortcutIndex[sequence];
+            QList<QAction *> conflicting;
+            for (QAction *other : std::as_const(actions)) {
+                if (canCollide(action, other)) {
+                    conflicting.append(other);
+                }
+            }
+            actions.append(action);
+            if (conflicting.isEmpty()) {
+                continue;
+            }
+            conflicting.append(action);
+
+            QList<QAction *> &reported = m_reportedConflicts[sequence];
+            const bool known = std::all_of(conflicting.cbegin(), conflicting.cend(), [&reported](QAction *a) {
+                return reported.contains(a);
+            });
+            if (!known) {
+                for (QAction *a : std::as_const(conflicting)) {
+                    if (!reported.contains(a)) {
+                        reported.append(a);
+                    }
+                }
+                qCDebug(KPARTSLOG) << "Ambiguous shortcut" << sequence.toString() << "used by" << conflicting;
+                Q_EMIT q->shortcutConflict(sequence, conflicting);
+            }
+        }
+    }
+
+    void removeShortcuts(QAction *action, const QList<QKeySequence> &shortcuts)
+    {
+        for (const QKeySequence &sequence : shortcuts) {
+            auto it = m_shortcutIndex.find(sequence);
+            if (it == m_shortcutIndex.end()) {
+                continue;
+            }
+            it->removeOne(action);
+            if (it->isEmpty()) {
+                m_shortcutIndex.erase(it);
+            }
+        }
+    }
+
+    // The widgets in which the shortcuts of an action may trigger it, nullopt if that can't be told,
+    // e.g. for actions only shown in menus. A window stands for all its widgets.
+    static std::optional<QList<QWidget *>> shortcutScope(QAction *action)
+    {
+        if (action->shortcutContext() == Qt::ApplicationShortcut) {
+            return std::nullopt;
+        }
+        QList<QWidget *> scope;
+        const QList<QObject *> objects = action->associatedObjects();
+        for (QObject *object : objects) {
+            QWidget *widget = qobject_cast<QWidget *>(object);
+            if (!widget || (widget->windowFlags() & Qt::Popup) == Qt::Popup) {
+                continue;
+            }
+            scope.append(action->shortcutContext() == Qt::WindowShortcut ? widget->window() : widget);
+        }
+        if (scope.isEmpty()) {
+            return std::nullopt;
+        }
+        return scope;
+    }
+
+    static bool scopeContains(QWidget *scopeWidget, Qt::ShortcutContext context, QWidget *widget)
+    {
+        return scopeWidget == widget || (context != Qt::WidgetShortcut && scopeWidget->isAncestorOf(widget));
+    }
+
+    // Whether one key press can reach both actions
+    static bool canCollide(QAction *action, QAction *other)
+    {
+        const std::optional<QList<QWidget *>> scope = shortcutScope(action);
+        const std::optional<QList<QWidget *>> otherScope = shortcutScope(other);
+        if (!scope || !otherScope) {
+            return true;
+        }
+        for (QWidget *widget : *scope) {
+            for (QWidget *otherWidget : *otherScope) {
+                if (scopeContains(widget, action->shortcutContext(), otherWidget)
+                    || scopeContains(otherWidget, other->shortcutContext(), widget)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void createHelpMenu(MainWindow *q)
+    {
+        m_helpMenu = new KHelpMenu(q);
+
+        KActionCollection *actions = q->actionCollection();
+        QAction *helpContentsAction = m_helpMenu->action(KHelpMenu::menuHelpContents);
+        QAction *whatsThisAction = m_helpMenu->action(KHelpMenu::menuWhatsThis);
+        QAction *reportBugAction = m_helpMenu->action(KHelpMenu::menuReportBug);
+        QAction *switchLanguageAction = m_helpMenu->action(KHelpMenu::menuSwitchLanguage);
+        QAction *aboutAppAction = m_helpMenu->action(KHelpMenu::menuAboutApp);
+        QAction *aboutKdeAction = m_helpMenu->action(KHelpMenu::menuAboutKDE);
+        QAction *donateAction = m_helpMenu->action(KHelpMenu::menuDonate);
+
+        if (helpContentsAction) {
+            actions->addAction(helpContentsAction->objectName(), helpContentsAction);
+        }
+        if (whatsThisAction) {
+            actions->addAction(whatsThisAction->objectName(), whatsThisAction);
+        }
+        if (reportBugAction) {
+            actions->addAction(reportBugAction->objectName(), reportBugAction);
+        }
+        if (switchLanguageAction) {
+            actions->addAction(switchLanguageAction->objectName(), switchLanguageAction);
+        }
+        if (aboutAppAction) {
+            actions->addAction(aboutAppAction->objectName(), aboutAppAction);
+        }
+        if (aboutKdeAction) {
+            actions->addAction(aboutKdeAction->objectName(), aboutKdeAction);
+        }
+        if (donateAction) {
+            actions->addAction(donateAction->objectName(), donateAction);
+        }
+    }
 };
 }
 
+// The clients removed or added along with a part
+static int clientCount(KXMLGUIClient *client)
+{
+    int count = 1;
+    const QList<KXMLGUIClient *> children = client->childClients();
+    for (KXMLGUIClient *child : children) {
+        count += clientCount(child);
+    }
+    return count;
+}
+
+// Identifies the menus and toolbars built by a client and its child clients. Only parts
+// keep the hash of their document until it changes, hashing the document of any other
+// client would cost more than the merge it saves, so they have none.
+static std::optional<size_t> guiSignature(KXMLGUIClient *client, size_t seed = 0)
+{
+    PartBase *partBase = dynamic_cast<PartBase *>(client);
+    if (!partBase) {
+        return std::nullopt;
+    }
+    seed = qHashMulti(seed, client->componentName(), client->xmlFile(), PartBasePrivate::get(partBase)->guiDocumentHash());
+    const QList<KXMLGUIClient *> children = client->childClients();
+    for (KXMLGUIClient *child : children) {
+        const std::optional<size_t> childSignature = guiSignature(child, seed);
+        if (!childSignature) {
+            return std::nullopt;
+        }
+        seed = *childSignature;
+    }
+    return seed;
+}
+
+// Collects the menus in a container and, recursively, their sub-menus
+static void collectMenus(QWidget *container, QList<QAction *> *menus)
+{
+    const QList<QAction *> actions = container->actions();
+    for (QAction *action : actions) {
+        if (QMenu *menu = action->menu()) {
+            menus->append(action);
+            collectMenus(menu, menus);
+        }
+    }
+}
+
 MainWindow::MainWindow(QWidget *parent, Qt::WindowFlags f)
     : KXmlGuiWindow(parent, f)
     , d(new MainWindowPrivate())
@@ -64,20 +530,55 @@ void MainWindow::createGUI(Part *part)
 
     Q_ASSERT(factory);
 
-    if (d->m_activePart) {
+    GUIMergeStatistics &stats = d->m_guiMergeStatistics;
+    ++stats.mergeCount;
+    stats.clientsRemoved = 0;
+    stats.clientsAdded = 0;
+    stats.incremental = false;
+    stats.removeNsecs = 0;
+    stats.addNsecs = 0;
+    stats.activateNsecs = 0;
+    stats.paintNsecs = -1;
+    QElapsedTimer timer;
+    timer.start();
+
+    Part *oldPart = d->m_activePart;
+
+    // Two parts building the same menus and toolbars, typically two documents of the
+    // same type, share the containers: adding the new part before removing the old one
+    // only plugs and unplugs their actions instead of rebuilding the whole GUI.
+    // A part prepared with prepareGUI() is already merged
+    const bool prepared = part && d->m_preparedGUIs.contains(part);
+    if (!prepared && oldPart && part && oldPart != part && d->m_bShellGUIActivated) {
+        const std::optional<size_t> signature = guiSignature(part);
+        stats.incremental = signature && signature == guiSignature(oldPart);
+    }
+    const bool updatesWereEnabled = updatesEnabled();
+    if (stats.incremental) {
+        setUpdatesEnabled(false);
+    }
+
+    if (oldPart) {
+        // Before the new part is indexed, the incremental merge adds it first
+        d->unindexClient(oldPart);
+
 #if 0
-        // qDebug() << "deactivating GUI for" << d->m_activePart
-                << d->m_activePart->metaObject()->className()
-                << d->m_activePart->objectName();
+        // qDebug() << "deactivating GUI for" << oldPart
+                << oldPart->metaObject()->className()
+                << oldPart->objectName();
 #endif
 
         GUIActivateEvent ev(false);
-        QApplication::sendEvent(d->m_activePart, &ev);
+        QApplication::sendEvent(oldPart, &ev);
 
-        factory->removeClient(d->m_activePart);
+        disconnect(oldPart, &Part::setWindowCaption, this, static_cast<void (MainWindow::*)(const QString &)>(&MainWindow::setCaption));
+        disconnect(oldPart, &Part::setStatusBarText, this, &MainWindow::slotSetStatusBarText);
 
-        disconnect(d->m_activePart.data(), &Part::setWindowCaption, this, static_cast<void (MainWindow::*)(const QString &)>(&MainWindow::setCaption));
-        disconnect(d->m_activePart.data(), &Part::setStatusBarText, this, &MainWindow::slotSetStatusBarText);
+        if (!stats.incremental) {
+            stats.clientsRemoved = clientCount(oldPart);
+            factory->removeClient(oldPart);
+            stats.removeNsecs = timer.nsecsElapsed();
+        }
     }
 
     if (!d->m_bShellGUIActivated) {
@@ -92,13 +593,200 @@ void MainWindow::createGUI(Part *part)
         }
         connect(part, &Part::setStatusBarText, this, &MainWindow::slotSetStatusBarText);
 
-        factory->addClient(part);
+        timer.restart();
+        if (prepared) {
+            d->revealPreparedGUI(part);
+        } else {
+            factory->addClient(part);
+        }
+        d->indexClient(this, part);
+        if (!prepared) {
+            stats.clientsAdded = clientCount(part);
+        }
+        stats.addNsecs = timer.nsecsElapsed();
+
+        if (stats.incremental) {
+            timer.restart();
+            stats.clientsRemoved = clientCount(oldPart);
+            factory->removeClient(oldPart);
+            stats.removeNsecs = timer.nsecsElapsed();
+            setUpdatesEnabled(updatesWereEnabled);
+        }
 
+        timer.restart();
         GUIActivateEvent ev(true);
         QApplication::sendEvent(part, &ev);
+        stats.activateNsecs = timer.nsecsElapsed();
     }
 
     d->m_activePart = part;
+
+    qCDebug(KPARTSLOG) << "GUI merge" << stats.mergeCount << "for" << part << ": removed" << stats.clientsRemoved << "clients in" << stats.removeNsecs / 1000
+                       << "us, added" << stats.clientsAdded << "clients in" << stats.addNsecs / 1000 << "us, GUI activation took" << stats.activateNsecs / 1000
+                       << "us" << (stats.incremental ? "(incremental)" : "");
+    d->m_repaintWatcher.watch(this);
+}
+
+void MainWindow::prepareGUI(Part *part)
+{
+    if (!part || part == d->m_activePart || part->factory() || d->m_preparedGUIs.contains(part)) {
+        return;
+    }
+
+    if (!d->m_bShellGUIActivated) {
+        createShellGUI();
+        d->m_bShellGUIActivated = true;
+    }
+
+    MainWindowPrivate::PreparedGUI prepared;
+    prepared.hidingGroup = new QActionGroup(this);
+    prepared.hidingGroup->setExclusionPolicy(QActionGroup::ExclusionPolicy::None);
+    prepared.hidingGroup->setVisible(false);
+    d->hideActions(part, &prepared, part);
+
+    // The toolbars and menus, including sub-menus, only this part has would still show, empty
+    const QList<KToolBar *> toolBarsBefore = toolBars();
+    QList<QAction *> menusBefore;
+    collectMenus(menuBar(), &menusBefore);
+
+    guiFactory()->addClient(part);
+
+    const QList<KToolBar *> bars = toolBars();
+    for (KToolBar *toolBar : bars) {
+        if (!toolBarsBefore.contains(toolBar) && !toolBar->isHidden()) {
+            toolBar->hide();
+            prepared.hiddenContainers.append(toolBar);
+        }
+    }
+    QList<QAction *> menus;
+    collectMenus(menuBar(), &menus);
+    for (QAction *menu : std::as_const(menus)) {
+        if (!menusBefore.contains(menu)) {
+            d->hideAction(part, &prepared, menu);
+        }
+    }
+
+    prepared.destroyedConnection = connect(part, &QObject::destroyed, this, [this, part]() {
+        // Before the actions go, so that they leave the group
+        MainWindowPrivate::releasePreparedGUI(d->m_preparedGUIs.take(part));
+    });
+    d->m_preparedGUIs.insert(part, prepared);
+}
+
+bool MainWindow::isGUIPrepared(Part *part) const
+{
+    return d->m_preparedGUIs.contains(part);
+}
+
+void MainWindow::discardPreparedGUI(Part *part)
+{
+    if (!d->m_preparedGUIs.contains(part)) {
+        return;
+    }
+    guiFactory()->removeClient(part);
+    // Leaves the actions as they were before prepareGUI()
+    d->revealPreparedGUI(part);
+}
+
+MainWindow::GUIMergeStatistics MainWindow::guiMergeStatistics() const
+{
+    return d->m_guiMergeStatistics;
+}
+
+void MainWindow::resetGUIMergeStatistics()
+{
+    d->m_guiMergeStatistics = GUIMergeStatistics();
+}
+
+bool MainWindow::queryCloseParts(const QList<Part *> &parts)
+{
+    QList<QPointer<ReadWritePart>> modifiedParts;
+    QStringList documentNames;
+    for (Part *part : parts) {
+        ReadWritePart *rwPart = qobject_cast<ReadWritePart *>(part);
+        if (rwPart && rwPart->isReadWrite() && rwPart->isModified()) {
+            modifiedParts.append(rwPart);
+            const QString docName = rwPart->url().fileName();
+            documentNames.append(docName.isEmpty() ? i18n("Untitled") : docName);
+        }
+    }
+
+    if (modifiedParts.isEmpty()) {
+        return true;
+    }
+
+    const int res = KMessageBox::warningTwoActionsCancelList(this,
+                                                             i18np("The following document has been modified.\n"
+                                                                   "Do you want to save your changes or discard them?",
+                                                                   "The following %1 documents have been modified.\n"
+                                                                   "Do you want to save your changes or discard them?",
+                                                                   modifiedParts.count()),
+                                                             documentNames,
+                                                             i18n("Close Documents"),
+                                                             KStandardGuiItem::save(),
+                                                             KStandardGuiItem::discard());
+    if (res != KMessageBox::PrimaryAction && res != KMessageBox::SecondaryAction) {
+        return false;
+    }
+
+    // Ask for the location of untitled documents before saving anything,
+    // so that canceling doesn't leave some documents saved and others not
+    QHash<ReadWritePart *, QUrl> saveAsUrls;
+    if (res == KMessageBox::PrimaryAction) {
+        for (const QPointer<ReadWritePart> &part : std::as_const(modifiedParts)) {
+            if (part && part->url().isEmpty()) {
+                const QUrl url = QFileDialog::getSaveFileUrl(part->widget() ? part->widget() : this);
+                if (url.isEmpty()) {
+                    return false;
+                }
+                saveAsUrls.insert(part, url);
+            }
+        }
+    }
+
+    // The parts don't prompt again given the answer above. Each save returns once its
+    // local file is written, one part after the other, only the uploads to remote URLs
+    // then overlap.
+    const ReadWritePart::QueryCloseAnswer answer = res == KMessageBox::PrimaryAction ? ReadWritePart::SaveChanges : ReadWritePart::DiscardChanges;
+    const int maxConcurrentSaves = std::max(1, d->m_maxConcurrentSaves);
+    QList<QPointer<ReadWritePart>> uploading;
+    bool allSaved = true;
+    for (const QPointer<ReadWritePart> &part : std::as_const(modifiedParts)) {
+        if (!part) {
+            continue;
+        }
+        while (uploading.count() >= maxConcurrentSaves) {
+            const QPointer<ReadWritePart> oldest = uploading.takeFirst();
+            if (oldest && !oldest->waitSaveComplete()) {
+                allSaved = false;
+            }
+        }
+
+        if (!part->answerQueryClose(answer, saveAsUrls.value(part))) {
+            allSaved = false;
+            break;
+        }
+        if (answer == ReadWritePart::SaveChanges) {
+            uploading.append(part);
+        }
+    }
+    for (const QPointer<ReadWritePart> &part : std::as_const(uploading)) {
+        if (part && !part->waitSaveComplete()) {
+            allSaved = false;
+        }
+    }
+
+    return allSaved;
+}
+
+void MainWindow::setMaximumConcurrentSaves(int count)
+{
+    d->m_maxConcurrentSaves = count;
+}
+
+int MainWindow::maximumConcurrentSaves() const
+{
+    return d->m_maxConcurrentSaves;
 }
 
 void MainWindow::slotSetStatusBarText(const QString &text)
@@ -111,39 +799,8 @@ void MainWindow::createShellGUI(bool create)
     Q_ASSERT(d->m_bShellGUIActivated != create);
     d->m_bShellGUIActivated = create;
     if (create) {
-        if (isHelpMenuEnabled() && !d->m_helpMenu) {
-            d->m_helpMenu = new KHelpMenu(this);
-
-            KActionCollection *actions = actionCollection();
-            QAction *helpContentsAction = d->m_helpMenu->action(KHelpMenu::menuHelpContents);
-            QAction *whatsThisAction = d->m_helpMenu->action(KHelpMenu::menuWhatsThis);
-            QAction *reportBugAction = d->m_helpMenu->action(KHelpMenu::menuReportBug);
-            QAction *switchLanguageAction = d->m_helpMenu->action(KHelpMenu::menuSwitchLanguage);
-            QAction *aboutAppAction = d->m_helpMenu->action(KHelpMenu::menuAboutApp);
-            QAction *aboutKdeAction = d->m_helpMenu->action(KHelpMenu::menuAboutKDE);
-            QAction *donateAction = d->m_helpMenu->action(KHelpMenu::menuDonate);
-
-            if (helpContentsAction) {
-                actions->addAction(helpContentsAction->objectName(), helpContentsAction);
-            }
-            if (whatsThisAction) {
-                actions->addAction(whatsThisAction->objectName(), whatsThisAction);
-            }
-            if (reportBugAction) {
-                actions->addAction(reportBugAction->objectName(), reportBugAction);
-            }
-            if (switchLanguageAction) {
-                actions->addAction(switchLanguageAction->objectName(), switchLanguageAction);
-            }
-            if (aboutAppAction) {
-                actions->addAction(aboutAppAction->objectName(), aboutAppAction);
-            }
-            if (aboutKdeAction) {
-                actions->addAction(aboutKdeAction->objectName(), aboutKdeAction);
-            }
-            if (donateAction) {
-                actions->addAction(donateAction->objectName(), donateAction);
-            }
+        if (isHelpMenuEnabled() && !d->m_helpMenu && !d->m_lazyShellGUI) {
+            d->createHelpMenu(this);
         }
 
         QString f = xmlFile();
@@ -160,8 +817,21 @@ void MainWindow::createShellGUI(bool create)
 
         guiFactory()->addClient(this);
 
-        checkAmbiguousShortcuts();
+        if (d->m_lazyShellGUI) {
+            d->m_shellGUIPending = true;
+            QTimer::singleShot(0, this, &MainWindow::completeShellGUI);
+        } else {
+            checkAmbiguousShortcuts();
+            d->indexClient(this, this);
+        }
     } else {
+        d->m_shellGUIPending = false;
+        d->unindexClient(this);
+        if (d->m_helpClient) {
+            guiFactory()->removeClient(d->m_helpClient.get());
+            d->m_helpClient.reset();
+        }
+
         GUIActivateEvent ev(false);
         QApplication::sendEvent(this, &ev);
 
@@ -169,6 +839,37 @@ void MainWindow::createShellGUI(bool create)
     }
 }
 
+void MainWindow::setLazyShellGUI(bool lazy)
+{
+    d->m_lazyShellGUI = lazy;
+}
+
+bool MainWindow::isLazyShellGUI() const
+{
+    return d->m_lazyShellGUI;
+}
+
+void MainWindow::completeShellGUI()
+{
+    if (!d->m_shellGUIPending) {
+        return;
+    }
+    d->m_shellGUIPending = false;
+
+    if (isHelpMenuEnabled() && !d->m_helpMenu) {
+        d->createHelpMenu(this);
+        d->m_helpClient = std::make_unique<HelpMenuClient>(this, d->m_helpMenu);
+        guiFactory()->addClient(d->m_helpClient.get());
+    }
+    checkAmbiguousShortcuts();
+    d->indexClient(this, this);
+}
+
+QList<QAction *> MainWindow::actionsForShortcut(const QKeySequence &sequence) const
+{
+    return d->m_shortcutIndex.value(sequence);
+}
+
 void KParts::MainWindow::setWindowTitleHandling(bool enabled)
 {
     d->m_manageWindowTitle = enabled;
@@ -176,15 +877,70 @@ void KParts::MainWindow::setWindowTitleHandling(bool enabled)
 
 void KParts::MainWindow::saveNewToolbarConfig()
 {
-    createGUI(d->m_activePart);
     KConfigGroup cg(KSharedConfig::openConfig(), QString());
-    applyMainWindowSettings(cg);
+
+    // The dialog of configureToolbars() merged the edited GUI again already,
+    // and what the toolbars looked like before is known
+    QObject *editor = sender();
+    const bool merged = editor && editor == d->m_toolBarEditor && !d->m_toolBarSnapshot.isEmpty()
+        && (!d->m_activePart || d->m_activePart->factory() == guiFactory());
+    if (!merged) {
+        createGUI(d->m_activePart);
+        applyMainWindowSettings(cg);
+        if (d->m_toolBarEditor) {
+            d->snapshotToolBars(this);
+        } else {
+            d->m_toolBarSnapshot.clear();
+        }
+        return;
+    }
+
+    const bool updatesWereEnabled = updatesEnabled();
+    setUpdatesEnabled(false);
+
+    // Lets the part plug its action lists again
+    if (d->m_activePart) {
+        GUIActivateEvent deactivateEvent(false);
+        QApplication::sendEvent(d->m_activePart, &deactivateEvent);
+        GUIActivateEvent activateEvent(true);
+        QApplication::sendEvent(d->m_activePart, &activateEvent);
+    }
+
+    // Same group names as KMainWindow::applyMainWindowSettings()
+    bool recreated = false;
+    int n = 1;
+    const QList<KToolBar *> bars = toolBars();
+    for (KToolBar *toolBar : bars) {
+        const auto it = std::find_if(d->m_toolBarSnapshot.cbegin(), d->m_toolBarSnapshot.cend(), [toolBar](const MainWindowPrivate::ToolBarSnapshot &snapshot) {
+            return snapshot.toolBar == toolBar;
+        });
+        if (it == d->m_toolBarSnapshot.cend()) {
+            // Its position in the window has to be restored as well
+            recreated = true;
+            break;
+        }
+        if (it->actions != toolBar->actions()) {
+            const QString group = QLatin1String("Toolbar") + (toolBar->objectName().isEmpty() ? QString::number(n) : QLatin1Char(' ') + toolBar->objectName());
+            KConfigGroup toolBarGroup(&cg, group);
+            toolBar->applySettings(toolBarGroup);
+        }
+        ++n;
+    }
+    if (recreated) {
+        applyMainWindowSettings(cg);
+    }
+
+    setUpdatesEnabled(updatesWereEnabled);
+    d->snapshotToolBars(this);
 }
 
 void KParts::MainWindow::configureToolbars()
 {
-    // No difference with base class anymore.
+    // What the toolbars look like before they are edited
+    d->snapshotToolBars(this);
     KXmlGuiWindow::configureToolbars();
+
+    d->m_toolBarEditor = findChild<KEditToolBar *>(QString(), Qt::FindDirectChildrenOnly);
 }
 
 #include "moc_mainwindow.cpp"
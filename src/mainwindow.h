@@ -12,8 +12,10 @@
 #include <kparts/part.h>
 
 #include <KXmlGuiWindow>
+#include <QKeySequence>
 #include <memory>
 
+class QAction;
 class QString;
 
 namespace KParts
@@ -62,9 +64,196 @@ public:
 
     ~MainWindow() override;
 
+    /*!
+     * Asks the user once whether to save the modified documents among \a parts,
+     * typically PartManager::parts(), for instance from KMainWindow::queryClose()
+     * when the shell is about to quit.
+     *
+     * Parts which are not read-write parts, or which are not modified, are ignored.
+     * If the user chooses to save, the locations of untitled documents are asked
+     * for first. The documents are then written one after the other, while their
+     * uploads to remote locations overlap, with at most maximumConcurrentSaves()
+     * of them at a time.
+     *
+     * The answer is handed to ReadWritePart::answerQueryClose() of each modified
+     * part, so handlers of ReadWritePart::sigQueryClose() still run, but
+     * reimplementations of ReadWritePart::queryClose() don't. If a handler aborts
+     * closing, the remaining documents are not saved.
+     *
+     * Returns true if the parts can be closed without the user losing data, i.e. all
+     * documents were saved or the user chose to discard the changes, and false if the
+     * user canceled or if any of the documents could not be saved.
+     *
+     * \sa ReadWritePart::answerQueryClose()
+     * \since 6.30
+     */
+    bool queryCloseParts(const QList<KParts::Part *> &parts);
+
+    /*!
+     * Sets the maximum number of documents queryCloseParts() uploads at the same time.
+     * The default is 4.
+     * \since 6.30
+     */
+    void setMaximumConcurrentSaves(int count);
+
+    /*!
+     * \sa setMaximumConcurrentSaves()
+     * \since 6.30
+     */
+    int maximumConcurrentSaves() const;
+
+    /*!
+     * Merges the GUI of \a part, which is about to be activated, ahead of time,
+     * for instance when the mouse hovers the tab showing it or when preloading.
+     *
+     * The actions of the part, and the toolbars, menus and sub-menus only it has,
+     * are kept hidden until createGUI() is called for \a part, which then only
+     * shows them. Actions the part hides itself in the meantime stay hidden.
+     *
+     * Does nothing if \a part is active or already merged.
+     *
+     * \sa discardPreparedGUI()
+     * \since 6.30
+     */
+    void prepareGUI(KParts::Part *part);
+
+    /*!
+     * Returns true if the GUI of \a part was merged by prepareGUI() and the part
+     * was not activated since.
+     * \since 6.30
+     */
+    bool isGUIPrepared(KParts::Part *part) const;
+
+    /*!
+     * Removes the GUI merged by prepareGUI() for \a part, when it is not going
+     * to be activated after all.
+     * \since 6.30
+     */
+    void discardPreparedGUI(KParts::Part *part);
+
+    /*!
+     * Sets whether the first createGUI() only builds what the window needs to be
+     * shown with its part.
+     *
+     * The help menu and the check for ambiguous shortcuts are then left for
+     * completeShellGUI(), which runs once the event loop is idle.
+     *
+     * \note This must be set before the first call to createGUI().
+     *
+     * \since 6.30
+     */
+    void setLazyShellGUI(bool lazy);
+
+    /*!
+     * \sa setLazyShellGUI()
+     * \since 6.30
+     */
+    bool isLazyShellGUI() const;
+
+    /*!
+     * \struct KParts::MainWindow::GUIMergeStatistics
+     * \inmodule KParts
+     *
+     * \brief Counters and durations, in nanoseconds, of the GUI merges done by createGUI().
+     *
+     * \since 6.30
+     */
+    struct GUIMergeStatistics {
+        /*!
+         * Number of createGUI() calls since the window was created or the statistics were reset.
+         */
+        int mergeCount = 0;
+        /*!
+         * Number of XMLGUI clients, i.e. the previous part and its child clients,
+         * removed by the last merge.
+         */
+        int clientsRemoved = 0;
+        /*!
+         * Number of XMLGUI clients, i.e. the new part and its child clients,
+         * added by the last merge. This is 0 when the merge only revealed a GUI
+         * added before by prepareGUI().
+         */
+        int clientsAdded = 0;
+        /*!
+         * Whether the last merge kept the menus and toolbars, because the previous
+         * and the new part build the same ones: the new part was added before the
+         * previous one was removed, so only their actions were swapped.
+         * Parts with child clients which are not parts are always merged fully.
+         */
+        bool incremental = false;
+        /*!
+         * Deactivating the GUI of the previous part and removing its clients.
+         */
+        qint64 removeNsecs = 0;
+        /*!
+         * Adding the clients of the new part.
+         */
+        qint64 addNsecs = 0;
+        /*!
+         * Sending the GUIActivateEvent to the new part.
+         */
+        qint64 activateNsecs = 0;
+        /*!
+         * Time from the end of the last merge until the window started repainting,
+         * or -1 if it didn't repaint yet.
+         */
+        qint64 paintNsecs = -1;
+    };
+
+    /*!
+     * Returns statistics about the GUI merges done when switching parts.
+     *
+     * The same numbers are logged in the kf.parts category at debug level.
+     *
+     * \sa PartManager::lastActivationTimings()
+     * \since 6.30
+     */
+    GUIMergeStatistics guiMergeStatistics() const;
+
+    /*!
+     * Resets the statistics returned by guiMergeStatistics().
+     * \since 6.30
+     */
+    void resetGUIMergeStatistics();
+
+    /*!
+     * Returns the enabled actions of the shell and of the active part which
+     * have \a sequence among their shortcuts.
+     *
+     * The index is updated as createGUI() merges and removes parts, and when
+     * the shortcuts of the indexed actions change.
+     *
+     * \sa shortcutConflict()
+     * \since 6.30
+     */
+    QList<QAction *> actionsForShortcut(const QKeySequence &sequence) const;
+
+Q_SIGNALS:
+    /*!
+     * Emitted when an enabled action of the shell or of the active part gets
+     * the shortcut \a sequence, which \a actions can all be triggered with.
+     * Actions whose shortcut contexts don't overlap, e.g. ones associated with
+     * different widgets, don't conflict.
+     *
+     * A conflict is only reported once, not each time createGUI() merges the
+     * part again. This comes in addition to the check of the shell's own
+     * actions done by KXmlGuiWindow::checkAmbiguousShortcuts().
+     * \sa actionsForShortcut()
+     * \since 6.30
+     */
+    void shortcutConflict(const QKeySequence &sequence, const QList<QAction *> &actions);
+
 public Q_SLOTS:
     void configureToolbars() override;
 
+    /*!
+     * Creates the parts of the shell GUI left out by setLazyShellGUI() right away,
+     * for instance before showing a dialog listing the window's shortcuts.
+     * Does nothing if there are none.
+     * \since 6.30
+     */
+    void completeShellGUI();
+
 protected Q_SLOTS:
 
     /*!
@@ -98,7 +287,14 @@ protected Q_SLOTS:
     virtual void slotSetStatusBarText(const QString &);
 
     /*!
-     * Rebuilds the GUI after KEditToolBar changed the toolbar layout.
+     * Updates the GUI after KEditToolBar changed the toolbar layout.
+     *
+     * When called by the KEditToolBar dialog of configureToolbars(), which
+     * already merged the edited GUI again, only the action lists of the active
+     * part are plugged again and the settings are only applied to the toolbars
+     * which changed. Otherwise, for instance when called directly or by a
+     * dialog the application opened itself, the GUI of the active part is rebuilt.
+     *
      * \sa configureToolbars()
      */
     void saveNewToolbarConfig() override;
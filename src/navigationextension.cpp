@@ -15,32 +15,118 @@
 #include <KUriFilter>
 
 #include <QApplication>
+#include <QBitArray>
 #include <QClipboard>
+#include <QDataStream>
 #include <QMap>
+#include <QPointer>
+#include <QQueue>
 #include <QRegularExpression>
 #include <QTimer>
+#include <QtEndian>
+
+#include <iterator>
 
 using namespace KParts;
 
+namespace
+{
+// The standard actions, which actionSlotMap() is built from. The index is the
+// action id, so the list has to stay sorted like the keys of the map.
+struct StandardAction {
+    const char *name;
+    std::size_t length;
+};
+
+constexpr StandardAction s_standardActions[] = {
+    {"copy", 4},
+    {"cut", 3},
+    {"paste", 5},
+    {"print", 5},
+};
+constexpr int s_standardActionCount = int(std::size(s_standardActions));
+
+constexpr bool isSortedByName()
+{
+    for (int i = 1; i < s_standardActionCount; ++i) {
+        const char *a = s_standardActions[i - 1].name;
+        const char *b = s_standardActions[i].name;
+        while (*a && *a == *b) {
+            ++a;
+            ++b;
+        }
+        if (static_cast<unsigned char>(*a) >= static_cast<unsigned char>(*b)) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(isSortedByName(), "The standard actions must be sorted by name, like actionSlotMap()");
+
+// Perfect hash of the names above, checked below
+constexpr std::size_t actionHash(std::size_t length, char second)
+{
+    return (length + static_cast<unsigned char>(second)) % 7;
+}
+
+struct ActionHashTable {
+    int ids[7];
+};
+
+constexpr ActionHashTable makeActionHashTable()
+{
+    ActionHashTable table{{-1, -1, -1, -1, -1, -1, -1}};
+    for (int i = 0; i < s_standardActionCount; ++i) {
+        table.ids[actionHash(s_standardActions[i].length, s_standardActions[i].name[1])] = i;
+    }
+    return table;
+}
+
+constexpr ActionHashTable s_actionHashTable = makeActionHashTable();
+
+constexpr bool isPerfectHash()
+{
+    for (int i = 0; i < s_standardActionCount; ++i) {
+        if (s_actionHashTable.ids[actionHash(s_standardActions[i].length, s_standardActions[i].name[1])] != i) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(isPerfectHash(), "Two standard actions share a hash value, change actionHash()");
+}
+
 namespace KParts
 {
-// Internal class, use to store the status of the actions
-class KBitArray
+// Restores the deferred state when the part's widget is first shown
+class ShowWatcher : public QObject
 {
 public:
-    int val = 0;
-    bool operator[](int index)
+    ShowWatcher(QWidget *widget, NavigationExtension *extension)
+        : m_widget(widget)
+        , m_extension(extension)
+    {
+        widget->installEventFilter(this);
+    }
+
+    ~ShowWatcher() override
     {
-        return (val & (1 << index)) ? true : false;
+        if (m_widget) {
+            m_widget->removeEventFilter(this);
+        }
     }
-    void setBit(int index, bool value)
+
+    bool eventFilter(QObject *obj, QEvent *ev) override
     {
-        if (value) {
-            val = val | (1 << index);
-        } else {
-            val = val & ~(1 << index);
+        if (obj == m_widget && ev->type() == QEvent::Show) {
+            QMetaObject::invokeMethod(m_extension, &NavigationExtension::restorePendingState, Qt::QueuedConnection);
         }
+        return false;
     }
+
+private:
+    QPointer<QWidget> m_widget;
+    NavigationExtension *const m_extension;
 };
 
 class NavigationExtensionPrivate
@@ -48,6 +134,8 @@ class NavigationExtensionPrivate
 public:
     NavigationExtensionPrivate(KParts::ReadOnlyPart *parent)
         : m_urlDropHandlingEnabled(false)
+        , m_actionStatus(s_standardActionCount)
+        , m_actionText(s_standardActionCount)
         , m_part(parent)
     {
     }
@@ -57,37 +145,51 @@ public:
         KParts::OpenUrlArguments m_delayedArgs;
     };
 
-    QList<DelayedRequest> m_requests;
+    QQueue<DelayedRequest> m_requests;
+    // Whether slotEmitOpenUrlRequestDelayed() is scheduled
+    bool m_dispatchPending = false;
+    NavigationExtension::RequestPolicy m_requestPolicy = NavigationExtension::QueueAllRequests;
+    int m_maxPendingRequests = -1;
+    NavigationExtension::RequestQueueStatistics m_requestStatistics;
+    QString m_contentCacheKey;
+    QMap<QString, QByteArray> m_stateData;
+
+    // Deferred restore: what restoreState() would have opened
+    bool m_deferredRestore = false;
+    bool m_restorePending = false;
+    QUrl m_pendingUrl;
+    KParts::OpenUrlArguments m_pendingArgs;
+    std::unique_ptr<QObject> m_showWatcher;
     bool m_urlDropHandlingEnabled;
-    KBitArray m_actionStatus;
-    QMap<int, QString> m_actionText;
+    QBitArray m_actionStatus;
+    // Null for the actions without a text set by the part
+    QList<QString> m_actionText;
 
     static void createActionSlotMap();
 
+    void cancelPendingRestore()
+    {
+        m_restorePending = false;
+        m_pendingUrl.clear();
+        m_pendingArgs = KParts::OpenUrlArguments();
+        m_showWatcher.reset();
+    }
+
     KParts::ReadOnlyPart *m_part;
 };
 
 Q_GLOBAL_STATIC(NavigationExtension::ActionSlotMap, s_actionSlotMap)
-Q_GLOBAL_STATIC(NavigationExtension::ActionNumberMap, s_actionNumberMap)
 
 void NavigationExtensionPrivate::createActionSlotMap()
 {
-    s_actionSlotMap()->insert("cut", SLOT(cut()));
-    s_actionSlotMap()->insert("copy", SLOT(copy()));
-    s_actionSlotMap()->insert("paste", SLOT(paste()));
-    s_actionSlotMap()->insert("print", SLOT(print()));
+    // What SLOT() gives for each standard action, built from the same list as the ids
+    for (const StandardAction &action : s_standardActions) {
+        s_actionSlotMap()->insert(action.name, QByteArray::number(QSLOT_CODE) + action.name + "()");
+    }
     // Tricky. Those aren't actions in fact, but simply methods that a browserextension
     // can have or not. No need to return them here.
     // s_actionSlotMap()->insert( "reparseConfiguration", SLOT(reparseConfiguration()) );
     // s_actionSlotMap()->insert( "refreshMimeTypes", SLOT(refreshMimeTypes()) );
-
-    // Create the action-number map
-    NavigationExtension::ActionSlotMap::ConstIterator it = s_actionSlotMap()->constBegin();
-    NavigationExtension::ActionSlotMap::ConstIterator itEnd = s_actionSlotMap()->constEnd();
-    for (int i = 0; it != itEnd; ++it, ++i) {
-        // qDebug() << " action " << it.key() << " number " << i;
-        s_actionNumberMap()->insert(it.key(), i);
-    }
 }
 
 }
@@ -96,26 +198,28 @@ NavigationExtension::NavigationExtension(KParts::ReadOnlyPart *parent)
     : QObject(parent)
     , d(new NavigationExtensionPrivate(parent))
 {
-    if (s_actionSlotMap()->isEmpty())
-    // Create the action-slot map
-    {
-        NavigationExtensionPrivate::createActionSlotMap();
-    }
-
     // Set the initial status of the actions depending on whether
     // they're supported or not
     const QMetaObject *metaobj = metaObject();
-    ActionSlotMap::ConstIterator it = s_actionSlotMap()->constBegin();
-    ActionSlotMap::ConstIterator itEnd = s_actionSlotMap()->constEnd();
-    for (int i = 0; it != itEnd; ++it, ++i) {
+    for (int i = 0; i < s_standardActionCount; ++i) {
         // Does the extension have a slot with the name of this action ?
-        QByteArray slotSig = it.key() + "()";
+        const QByteArray slotSig = QByteArray(s_standardActions[i].name) + "()";
         d->m_actionStatus.setBit(i, metaobj->indexOfMethod(slotSig.constData()) != -1);
     }
 
     connect(this, &NavigationExtension::openUrlRequest, this, &NavigationExtension::slotOpenUrlRequest);
     connect(this, &NavigationExtension::enableAction, this, &NavigationExtension::slotEnableAction);
     connect(this, &NavigationExtension::setActionText, this, &NavigationExtension::slotSetActionText);
+
+    // A document opened in the meantime wins over a deferred restore
+    if (parent) {
+        connect(parent, &ReadOnlyPart::urlChanged, this, [this]() {
+            d->cancelPendingRestore();
+        });
+        connect(parent, &ReadOnlyPart::started, this, [this]() {
+            d->cancelPendingRestore();
+        });
+    }
 }
 
 NavigationExtension::~NavigationExtension()
@@ -133,10 +237,25 @@ int NavigationExtension::yOffset()
     return 0;
 }
 
+// A legacy state starts with the length of the encoded URL: 0xFFFFFFFF when null,
+// 0xFFFFFFFE followed by a 64-bit size with Qt_6_7 and later streams, and the size
+// itself otherwise. This one would stand for a URL of almost 4 GiB.
+static constexpr quint32 s_stateMagic = 0xFFFFFFFD;
+static constexpr quint32 s_stateVersion = 1;
+
 void NavigationExtension::saveState(QDataStream &stream)
 {
-    // TODO add d->m_part->mimeType()
-    stream << d->m_part->url() << static_cast<qint32>(xOffset()) << static_cast<qint32>(yOffset());
+    const OpenUrlArguments args = d->m_part->arguments();
+
+    // Fields are only ever appended, readers skip what they don't know
+    QByteArray payload;
+    {
+        QDataStream payloadStream(&payload, QIODevice::WriteOnly);
+        payloadStream.setVersion(QDataStream::Qt_6_0);
+        payloadStream << d->m_part->url() << static_cast<qint32>(xOffset()) << static_cast<qint32>(yOffset());
+        payloadStream << args.mimeType() << args.metaData() << d->m_contentCacheKey << d->m_stateData;
+    }
+    stream << s_stateMagic << s_stateVersion << payload;
 }
 
 void NavigationExtension::restoreState(QDataStream &stream)
@@ -144,16 +263,123 @@ void NavigationExtension::restoreState(QDataStream &stream)
     QUrl u;
     qint32 xOfs;
     qint32 yOfs;
-    stream >> u >> xOfs >> yOfs;
-
     OpenUrlArguments args;
+
+    // Replaces what an earlier deferred call recorded
+    d->cancelPendingRestore();
+
+    const QByteArray header = stream.device() ? stream.device()->peek(sizeof(quint32)) : QByteArray();
+    const quint32 first = header.size() == int(sizeof(quint32))
+        ? (stream.byteOrder() == QDataStream::BigEndian ? qFromBigEndian<quint32>(header.constData()) : qFromLittleEndian<quint32>(header.constData()))
+        : 0;
+    if (first == s_stateMagic) {
+        quint32 magic;
+        quint32 version;
+        QByteArray payload;
+        stream >> magic >> version >> payload;
+
+        QDataStream payloadStream(payload);
+        payloadStream.setVersion(QDataStream::Qt_6_0);
+        QString mimeType;
+        QMap<QString, QString> metaData;
+        payloadStream >> u >> xOfs >> yOfs >> mimeType >> metaData >> d->m_contentCacheKey >> d->m_stateData;
+        if (payloadStream.status() != QDataStream::Ok) {
+            qCWarning(KPARTSLOG) << "Invalid navigation state, version" << version;
+        }
+        args.setMimeType(mimeType);
+        args.metaData() = metaData;
+    } else {
+        // State saved before 6.30
+        stream >> u >> xOfs >> yOfs;
+        d->m_contentCacheKey.clear();
+        d->m_stateData.clear();
+    }
+
     args.setXOffset(xOfs);
     args.setYOffset(yOfs);
-    // TODO add args.setMimeType
+
+    if (d->m_deferredRestore) {
+        d->m_pendingUrl = u;
+        d->m_pendingArgs = args;
+        d->m_restorePending = true;
+        watchForShow();
+        return;
+    }
     d->m_part->setArguments(args);
     d->m_part->openUrl(u);
 }
 
+void NavigationExtension::setDeferredRestore(bool deferred)
+{
+    d->m_deferredRestore = deferred;
+}
+
+bool NavigationExtension::isDeferredRestore() const
+{
+    return d->m_deferredRestore;
+}
+
+bool NavigationExtension::isRestorePending() const
+{
+    return d->m_restorePending;
+}
+
+QUrl NavigationExtension::pendingRestoreUrl() const
+{
+    return d->m_restorePending ? d->m_pendingUrl : QUrl();
+}
+
+void NavigationExtension::restorePendingState()
+{
+    if (!d->m_restorePending) {
+        return;
+    }
+    const QUrl url = d->m_pendingUrl;
+    const OpenUrlArguments args = d->m_pendingArgs;
+    d->cancelPendingRestore();
+
+    d->m_part->setArguments(args);
+    d->m_part->openUrl(url);
+}
+
+void NavigationExtension::watchForShow()
+{
+    QWidget *widget = d->m_part->widget();
+    if (!widget) {
+        return;
+    }
+    if (widget->isVisible()) {
+        // Let the caller finish restoring first
+        QMetaObject::invokeMethod(this, &NavigationExtension::restorePendingState, Qt::QueuedConnection);
+        return;
+    }
+    d->m_showWatcher = std::make_unique<ShowWatcher>(widget, this);
+}
+
+void NavigationExtension::setContentCacheKey(const QString &key)
+{
+    d->m_contentCacheKey = key;
+}
+
+QString NavigationExtension::contentCacheKey() const
+{
+    return d->m_contentCacheKey;
+}
+
+void NavigationExtension::setStateData(const QString &key, const QByteArray &data)
+{
+    if (data.isNull()) {
+        d->m_stateData.remove(key);
+    } else {
+        d->m_stateData.insert(key, data);
+    }
+}
+
+QByteArray NavigationExtension::stateData(const QString &key) const
+{
+    return d->m_stateData.value(key);
+}
+
 bool NavigationExtension::isURLDropHandlingEnabled() const
 {
     return d->m_urlDropHandlingEnabled;
@@ -207,31 +433,99 @@ void NavigationExtension::pasteRequest()
 void NavigationExtension::slotOpenUrlRequest(const QUrl &url, const KParts::OpenUrlArguments &args)
 {
     // qDebug() << this << " BrowserExtension::slotOpenURLRequest(): url=" << url.url();
+    RequestQueueStatistics &stats = d->m_requestStatistics;
+    if (d->m_requestPolicy == LatestRequestWins) {
+        stats.coalesced += d->m_requests.count();
+        d->m_requests.clear();
+    } else if (d->m_maxPendingRequests > 0 && d->m_requests.count() >= d->m_maxPendingRequests) {
+        qCWarning(KPARTSLOG) << "Too many pending URL requests, dropping the request for" << d->m_requests.head().m_delayedURL;
+        d->m_requests.dequeue();
+        ++stats.dropped;
+    }
+
     NavigationExtensionPrivate::DelayedRequest req;
     req.m_delayedURL = url;
     req.m_delayedArgs = args;
-    d->m_requests.append(req);
-    QTimer::singleShot(0, this, &NavigationExtension::slotEmitOpenUrlRequestDelayed);
+    d->m_requests.enqueue(req);
+    stats.pending = d->m_requests.count();
+    stats.maximumPending = qMax(stats.maximumPending, stats.pending);
+
+    // A single timer for the whole queue
+    if (!d->m_dispatchPending) {
+        d->m_dispatchPending = true;
+        QTimer::singleShot(0, this, &NavigationExtension::slotEmitOpenUrlRequestDelayed);
+    }
 }
 
 void NavigationExtension::slotEmitOpenUrlRequestDelayed()
 {
-    if (d->m_requests.isEmpty()) {
-        return;
+    d->m_dispatchPending = false;
+
+    // Only the requests made so far, those made by the receivers wait for the next round
+    QPointer<NavigationExtension> guard(this);
+    for (int count = d->m_requests.count(); count > 0 && !d->m_requests.isEmpty(); --count) {
+        const NavigationExtensionPrivate::DelayedRequest req = d->m_requests.dequeue();
+        d->m_requestStatistics.pending = d->m_requests.count();
+        ++d->m_requestStatistics.emitted;
+        Q_EMIT openUrlRequestDelayed(req.m_delayedURL, req.m_delayedArgs);
+        // tricky: the receiver may have deleted us
+        if (!guard) {
+            return;
+        }
     }
-    NavigationExtensionPrivate::DelayedRequest req = d->m_requests.front();
-    d->m_requests.pop_front();
-    Q_EMIT openUrlRequestDelayed(req.m_delayedURL, req.m_delayedArgs);
-    // tricky: do not do anything here! (no access to member variables, etc.)
+
+    if (!d->m_requests.isEmpty() && !d->m_dispatchPending) {
+        d->m_dispatchPending = true;
+        QTimer::singleShot(0, this, &NavigationExtension::slotEmitOpenUrlRequestDelayed);
+    }
+}
+
+void NavigationExtension::setRequestPolicy(RequestPolicy policy)
+{
+    d->m_requestPolicy = policy;
+}
+
+NavigationExtension::RequestPolicy NavigationExtension::requestPolicy() const
+{
+    return d->m_requestPolicy;
+}
+
+void NavigationExtension::setMaximumPendingRequests(int count)
+{
+    // The new request itself always waits for the event loop
+    d->m_maxPendingRequests = count < 0 ? -1 : qMax(1, count);
+}
+
+int NavigationExtension::maximumPendingRequests() const
+{
+    return d->m_maxPendingRequests;
+}
+
+NavigationExtension::RequestQueueStatistics NavigationExtension::requestQueueStatistics() const
+{
+    return d->m_requestStatistics;
+}
+
+int NavigationExtension::actionId(const char *name)
+{
+    if (!name || !name[0]) {
+        return -1;
+    }
+    const std::size_t length = qstrlen(name);
+    const int id = s_actionHashTable.ids[actionHash(length, name[1])];
+    if (id < 0 || s_standardActions[id].length != length || qstrcmp(s_standardActions[id].name, name) != 0) {
+        return -1;
+    }
+    return id;
 }
 
 void NavigationExtension::slotEnableAction(const char *name, bool enabled)
 {
     // qDebug() << "BrowserExtension::slotEnableAction " << name << " " << enabled;
-    ActionNumberMap::ConstIterator it = s_actionNumberMap()->constFind(name);
-    if (it != s_actionNumberMap()->constEnd()) {
-        d->m_actionStatus.setBit(it.value(), enabled);
-        // qDebug() << "BrowserExtension::slotEnableAction setting bit " << it.data() << " to " << enabled;
+    const int id = actionId(name);
+    if (id >= 0) {
+        d->m_actionStatus.setBit(id, enabled);
+        // qDebug() << "BrowserExtension::slotEnableAction setting bit " << id << " to " << enabled;
     } else {
         qCWarning(KPARTSLOG) << "BrowserExtension::slotEnableAction unknown action " << name;
     }
@@ -239,16 +533,20 @@ void NavigationExtension::slotEnableAction(const char *name, bool enabled)
 
 bool NavigationExtension::isActionEnabled(const char *name) const
 {
-    int actionNumber = (*s_actionNumberMap())[name];
-    return d->m_actionStatus[actionNumber];
+    return isActionEnabled(actionId(name));
+}
+
+bool NavigationExtension::isActionEnabled(int id) const
+{
+    return id >= 0 && id < d->m_actionStatus.size() && d->m_actionStatus.testBit(id);
 }
 
 void NavigationExtension::slotSetActionText(const char *name, const QString &text)
 {
     // qDebug() << "BrowserExtension::slotSetActionText " << name << " " << text;
-    ActionNumberMap::ConstIterator it = s_actionNumberMap()->constFind(name);
-    if (it != s_actionNumberMap()->constEnd()) {
-        d->m_actionText[it.value()] = text;
+    const int id = actionId(name);
+    if (id >= 0) {
+        d->m_actionText[id] = text;
     } else {
         qCWarning(KPARTSLOG) << "BrowserExtension::slotSetActionText unknown action " << name;
     }
@@ -256,12 +554,12 @@ void NavigationExtension::slotSetActionText(const char *name, const QString &tex
 
 QString NavigationExtension::actionText(const char *name) const
 {
-    int actionNumber = (*s_actionNumberMap())[name];
-    QMap<int, QString>::ConstIterator it = d->m_actionText.constFind(actionNumber);
-    if (it != d->m_actionText.constEnd()) {
-        return *it;
-    }
-    return QString();
+    return actionText(actionId(name));
+}
+
+QString NavigationExtension::actionText(int id) const
+{
+    return id >= 0 && id < d->m_actionText.size() ? d->m_actionText.at(id) : QString();
 }
 
 NavigationExtension::ActionSlotMap *NavigationExtension::actionSlotMap()
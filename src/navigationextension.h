@@ -155,6 +155,11 @@ public:
      *
      * If you want to save additional properties, reimplement it
      * but don't forget to call the parent method (probably first).
+     * Alternatively, use setStateData().
+     *
+     * Since 6.30, the state is versioned and also holds the MIME type and
+     * the metadata of the part's arguments, the contentCacheKey() and the
+     * stateData(). Older versions can't read it.
      */
     virtual void saveState(QDataStream &stream);
 
@@ -164,9 +169,78 @@ public:
      *
      * If you saved additional properties, reimplement it
      * but don't forget to call the parent method (probably first).
+     *
+     * The saved MIME type is passed to the part with the arguments,
+     * so that it isn't determined again. States saved by older versions
+     * are still read.
      */
     virtual void restoreState(QDataStream &stream);
 
+    /*!
+     * Sets whether restoreState() defers opening the saved URL.
+     *
+     * The URL and arguments are then only recorded, and opened by
+     * restorePendingState(), which is called when the part's widget is first
+     * shown, when a PartManager activates the part, or by
+     * PartManager::restorePendingParts(). This keeps restoring a session with
+     * many views from loading all their documents at once.
+     *
+     * The pending restore is dropped when the part opens a URL in the meantime,
+     * or when restoreState() is called again.
+     *
+     * \sa isRestorePending()
+     * \since 6.30
+     */
+    void setDeferredRestore(bool deferred);
+    /*!
+     * \sa setDeferredRestore()
+     * \since 6.30
+     */
+    bool isDeferredRestore() const;
+
+    /*!
+     * Returns true if restoreState() recorded a URL which was not opened yet.
+     * \sa setDeferredRestore()
+     * \since 6.30
+     */
+    bool isRestorePending() const;
+
+    /*!
+     * Returns the URL restorePendingState() will open, e.g. for the title of
+     * a tab, or an empty URL if no restore is pending.
+     * \since 6.30
+     */
+    QUrl pendingRestoreUrl() const;
+
+    /*!
+     * Sets a key under which the part or the host cached the content of the
+     * current document, saved and restored with the state so that a restored
+     * view can reuse the cached data instead of loading it again.
+     * \sa saveState()
+     * \since 6.30
+     */
+    void setContentCacheKey(const QString &key);
+    /*!
+     * \sa setContentCacheKey()
+     * \since 6.30
+     */
+    QString contentCacheKey() const;
+
+    /*!
+     * Stores \a data under \a key, to be saved with the state of the view.
+     * A null \a data removes the key.
+     *
+     * After restoreState(), returns the data that was saved.
+     * \sa saveState()
+     * \since 6.30
+     */
+    void setStateData(const QString &key, const QByteArray &data);
+    /*!
+     * \sa setStateData()
+     * \since 6.30
+     */
+    QByteArray stateData(const QString &key) const;
+
     /*!
      * Returns whether url drop handling is enabled.
      * See setURLDropHandlingEnabled for more information about this
@@ -194,6 +268,16 @@ public:
      */
     bool isActionEnabled(const char *name) const;
 
+    /*!
+     * Returns the status of the action \a id, as returned by actionId().
+     *
+     * Unlike the overload taking a name, this does not look the name up, for
+     * hosts querying the status often.
+     *
+     * \since 6.30
+     */
+    bool isActionEnabled(int id) const;
+
     /*!
      * Returns the text of an action, if it was set explicitly by the part.
      * When the setActionText signal is emitted, the browserextension
@@ -202,6 +286,22 @@ public:
      */
     QString actionText(const char *name) const;
 
+    /*!
+     * Returns the text of the action \a id, as returned by actionId().
+     * \since 6.30
+     */
+    QString actionText(int id) const;
+
+    /*!
+     * Returns the id of the standard action \a name (e.g. "copy"), or -1 if it is
+     * not one. The ids are constant, hosts can look them up once.
+     *
+     * The ids follow the order of actionSlotMap().
+     *
+     * \since 6.30
+     */
+    static int actionId(const char *name);
+
     /*!
      * \typedef KParts::NavigationExtension::ActionSlotMap
      */
@@ -249,6 +349,88 @@ public:
      */
     void pasteRequest();
 
+    /*!
+     * How openUrlRequest() calls are queued until they are emitted as
+     * openUrlRequestDelayed().
+     *
+     * \value QueueAllRequests Every request is emitted, in order.
+     * \value LatestRequestWins A new request replaces the ones not emitted yet,
+     *        for parts where only the last navigation matters.
+     *
+     * \since 6.30
+     */
+    enum RequestPolicy {
+        QueueAllRequests,
+        LatestRequestWins,
+    };
+
+    /*!
+     * Sets how the requests waiting to be emitted are queued.
+     * The default is QueueAllRequests.
+     * \since 6.30
+     */
+    void setRequestPolicy(RequestPolicy policy);
+    /*!
+     * \sa setRequestPolicy()
+     * \since 6.30
+     */
+    RequestPolicy requestPolicy() const;
+
+    /*!
+     * Sets how many requests may wait to be emitted. When a new request arrives
+     * while the queue is full, the oldest waiting request is dropped.
+     *
+     * Requests are always emitted once the event loop runs, so that the part isn't
+     * deleted by a receiver while it makes the request: 0 is treated as 1, which
+     * keeps only the latest request. Any negative value, such as the default of -1,
+     * means no limit.
+     * \since 6.30
+     */
+    void setMaximumPendingRequests(int count);
+    /*!
+     * \sa setMaximumPendingRequests()
+     * \since 6.30
+     */
+    int maximumPendingRequests() const;
+
+    /*!
+     * \struct KParts::NavigationExtension::RequestQueueStatistics
+     * \inmodule KParts
+     *
+     * \brief Counters about the openUrlRequest() queue.
+     *
+     * \since 6.30
+     */
+    struct RequestQueueStatistics {
+        /*!
+         * Requests waiting to be emitted.
+         */
+        int pending = 0;
+        /*!
+         * Highest number of requests that waited at the same time.
+         */
+        int maximumPending = 0;
+        /*!
+         * Requests emitted as openUrlRequestDelayed().
+         */
+        qint64 emitted = 0;
+        /*!
+         * Requests replaced by a later one, with LatestRequestWins.
+         */
+        qint64 coalesced = 0;
+        /*!
+         * Requests dropped because the queue was full.
+         */
+        qint64 dropped = 0;
+    };
+
+    /*!
+     * Returns the counters of the openUrlRequest() queue since the extension
+     * was created.
+     * \since 6.30
+     */
+    RequestQueueStatistics requestQueueStatistics() const;
+
     /*!
      * Associates a list of actions with a predefined name known by the host's popupmenu:
      *
@@ -437,6 +619,14 @@ Q_SIGNALS:
      */
     void itemsRemoved(const KFileItemList &items);
 
+public Q_SLOTS:
+    /*!
+     * Opens the URL recorded by a deferred restoreState(), if any.
+     * \sa setDeferredRestore()
+     * \since 6.30
+     */
+    void restorePendingState();
+
 private Q_SLOTS:
     KPARTS_NO_EXPORT void slotOpenUrlRequest(const QUrl &url, const KParts::OpenUrlArguments &arguments = KParts::OpenUrlArguments());
 
@@ -448,6 +638,8 @@ public:
     typedef QMap<QByteArray, int> ActionNumberMap;
 
 private:
+    KPARTS_NO_EXPORT void watchForShow();
+
     std::unique_ptr<NavigationExtensionPrivate> const d;
 };
 
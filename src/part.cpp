@@ -112,8 +112,12 @@ Part *Part::hitTest(QWidget *widget, const QPoint &)
 void Part::setWidget(QWidget *widget)
 {
     Q_D(Part);
+    QWidget *oldWidget = d->m_widget;
     d->m_widget = widget;
     connect(d->m_widget.data(), &QWidget::destroyed, this, &Part::slotWidgetDestroyed, Qt::UniqueConnection);
+    if (d->m_manager && oldWidget != widget) {
+        d->m_manager->partWidgetChanged(this, oldWidget);
+    }
 }
 
 void Part::customEvent(QEvent *ev)
@@ -153,6 +157,9 @@ void Part::slotWidgetDestroyed()
     Q_D(Part);
 
     d->m_widget = nullptr;
+    if (d->m_manager) {
+        d->m_manager->partWidgetChanged(this, static_cast<QWidget *>(sender()));
+    }
     if (d->m_autoDeletePart) {
         // qCDebug(KPARTSLOG) << "deleting part" << objectName();
         this->deleteLater();
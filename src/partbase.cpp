@@ -9,8 +9,67 @@
 #include "partbase.h"
 #include "partbase_p.h"
 
+#include <QCache>
+#include <QDateTime>
+#include <QDir>
+#include <QDomDocument>
+#include <QFileInfo>
+#include <QStandardPaths>
+
+#include <utility>
+
 using namespace KParts;
 
+namespace
+{
+// Parsed GUI descriptions, by guiDocumentKey(). The documents never leave the
+// cache, clients get deep copies: KXMLGUIClient edits its document in place.
+struct GUIDocument {
+    QDomDocument document;
+};
+
+// Enough for the part plugins of a typical shell
+constexpr int s_maxCachedGUIDocuments = 32;
+
+QCache<QString, GUIDocument> &guiDocumentCache()
+{
+    static QCache<QString, GUIDocument> cache(s_maxCachedGUIDocuments);
+    return cache;
+}
+
+// The files KXMLGUIClient::setXMLFile() picks the GUI description from, with their
+// modification time and size, so that a changed file is read again. Empty when
+// none is found at the usual locations, the file is then left to KXMLGUIClient.
+QString guiDocumentKey(const QString &componentName, const QString &file, const QString &localFile)
+{
+    QStringList files;
+    if (QDir::isRelativePath(file)) {
+        const QString filter = componentName + QLatin1Char('/') + file;
+        files = QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, QLatin1String("kxmlgui5/") + filter);
+        const QString qrcFile = QLatin1String(":/kxmlgui5/") + filter;
+        if (QFile::exists(qrcFile)) {
+            files.append(qrcFile);
+        }
+    } else if (QFile::exists(file)) {
+        files.append(file);
+    }
+    if (files.isEmpty()) {
+        return QString();
+    }
+    if (!localFile.isEmpty() && !files.contains(localFile) && QFile::exists(localFile)) {
+        files.prepend(localFile);
+    }
+
+    QString key = componentName + QLatin1Char('|') + file;
+    for (const QString &path : std::as_const(files)) {
+        const QFileInfo info(path);
+        key += QLatin1Char('|') + path + QLatin1Char('|') + QString::number(info.lastModified().toMSecsSinceEpoch()) + QLatin1Char('|')
+            + QString::number(info.size());
+    }
+    return key;
+}
+}
+
 PartBase::PartBase()
     : d_ptr(new PartBasePrivate(this))
 {
@@ -36,3 +95,64 @@ QObject *PartBase::partObject() const
 
     return d->m_obj;
 }
+
+void PartBase::setXMLFile(const QString &file, bool merge, bool setXMLDoc)
+{
+    Q_D(PartBase);
+
+    const QString key = merge || !setXMLDoc || file.isEmpty() ? QString() : guiDocumentKey(componentName(), file, localXMLFile());
+    if (key.isEmpty()) {
+        KXMLGUIClient::setXMLFile(file, merge, setXMLDoc);
+        return;
+    }
+
+    if (const GUIDocument *cached = guiDocumentCache().object(key)) {
+        // Only records the file name, the files didn't change since they were parsed
+        KXMLGUIClient::setXMLFile(file, false, false);
+        // Copying the tree is much cheaper than parsing it again
+        setDOMDocument(cached->document.cloneNode(true).toDocument(), false);
+        return;
+    }
+
+    // Reads the files and calls setXML(), which fills the cache
+    d->m_guiDocumentKey = key;
+    KXMLGUIClient::setXMLFile(file, merge, setXMLDoc);
+    d->m_guiDocumentKey.clear();
+}
+
+void PartBase::setXML(const QString &document, bool merge)
+{
+    Q_D(PartBase);
+
+    const QString key = std::exchange(d->m_guiDocumentKey, QString());
+    if (merge || document.isEmpty() || key.isEmpty()) {
+        KXMLGUIClient::setXML(document, merge);
+        return;
+    }
+
+    QDomDocument doc;
+    if (!doc.setContent(QAnyStringView(document))) {
+        KXMLGUIClient::setXML(document, merge); // reports the error
+        return;
+    }
+    guiDocumentCache().insert(key, new GUIDocument{doc});
+    setDOMDocument(doc.cloneNode(true).toDocument(), false);
+}
+
+void PartBase::setDOMDocument(const QDomDocument &document, bool merge)
+{
+    Q_D(PartBase);
+
+    d->m_guiDocumentHash.reset();
+    KXMLGUIClient::setDOMDocument(document, merge);
+}
+
+size_t PartBasePrivate::guiDocumentHash()
+{
+    Q_Q(PartBase);
+
+    if (!m_guiDocumentHash) {
+        m_guiDocumentHash = qHash(q->domDocument().toString());
+    }
+    return *m_guiDocumentHash;
+}
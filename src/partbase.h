@@ -54,6 +54,35 @@ public:
     QObject *partObject() const;
 
 protected:
+    /*!
+     * Reimplemented to read and parse the GUI description only once for the
+     * parts that load the same one, typically the instances of one part plugin
+     * calling setXMLFile() with the same file. The files are only checked for
+     * changes of their modification time and size. Each part still gets its own
+     * copy of the document, since KXMLGUIClient modifies it in place.
+     *
+     * This applies to every subclass of PartBase, including KParts::MainWindow.
+     *
+     * \since 6.30
+     */
+    void setXMLFile(const QString &file, bool merge = false, bool setXMLDoc = true) override;
+
+    /*!
+     * Reimplemented to fill the cache used by setXMLFile().
+     *
+     * \since 6.30
+     */
+    void setXML(const QString &document, bool merge = false) override;
+
+    /*!
+     * Reimplemented to notice changes of the GUI description, which
+     * KParts::MainWindow compares when switching between parts. Like
+     * setXMLFile(), this applies to every subclass of PartBase.
+     *
+     * \since 6.30
+     */
+    void setDOMDocument(const QDomDocument &document, bool merge = false) override;
+
     KPARTS_NO_EXPORT explicit PartBase(PartBasePrivate &dd);
 
     std::unique_ptr<PartBasePrivate> const d_ptr;
@@ -11,6 +11,8 @@
 
 #include "partbase.h"
 
+#include <optional>
+
 namespace KParts
 {
 class PartBasePrivate
@@ -28,8 +30,19 @@ public:
     {
     }
 
+    static PartBasePrivate *get(PartBase *q)
+    {
+        return q->d_func();
+    }
+
+    // Hash of the GUI description, computed on first use after each change
+    size_t guiDocumentHash();
+
     PartBase *q_ptr;
     QObject *m_obj;
+    std::optional<size_t> m_guiDocumentHash;
+    // Set by setXMLFile() for the setXML() call of KXMLGUIClient::setXMLFile()
+    QString m_guiDocumentKey;
 };
 
 } // namespace
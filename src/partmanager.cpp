@@ -9,17 +9,171 @@
 #include "partmanager.h"
 
 #include "kparts_logging.h"
+#include "navigationextension.h"
 #include "part.h"
 #include "partactivateevent.h"
+#include "partloader.h"
+#include "partsuspendevent.h"
+#include "readwritepart.h"
 
 #include <QApplication>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QLayout>
 #include <QMouseEvent>
+#include <QPointer>
 #include <QScrollBar>
+#include <QSet>
+#include <QSplitter>
+#include <QStackedWidget>
+#include <QTabWidget>
+#include <QTimer>
+
+#include <algorithm>
 
 using namespace KParts;
 
 namespace KParts
 {
+// Single application event filter shared by the part managers in SharedDispatcher mode
+class PartManagerDispatcher : public QObject
+{
+public:
+    static void addManager(const QWidget *topLevel, PartManager *manager)
+    {
+        if (!s_self) {
+            s_self = new PartManagerDispatcher;
+            qApp->installEventFilter(s_self);
+        }
+        s_self->m_managers[topLevel].append(manager);
+    }
+
+    static void removeManager(const QWidget *topLevel, PartManager *manager)
+    {
+        if (!s_self) {
+            return;
+        }
+        auto it = s_self->m_managers.find(topLevel);
+        if (it != s_self->m_managers.end()) {
+            it->removeAll(manager);
+            if (it->isEmpty()) {
+                s_self->m_managers.erase(it);
+            }
+        }
+        if (s_self->m_managers.isEmpty()) {
+            delete s_self;
+            s_self = nullptr;
+        }
+    }
+
+    bool eventFilter(QObject *obj, QEvent *ev) override
+    {
+        if (ev->type() == QEvent::ParentChange || ev->type() == QEvent::ModalityChange) {
+            // Lets the managers forget what they know about the widget hierarchy
+            const QSet<PartManager *> managers = allManagers();
+            for (PartManager *manager : managers) {
+                manager->eventFilter(obj, ev);
+            }
+            return false;
+        }
+        if (ev->type() != QEvent::MouseButtonPress && ev->type() != QEvent::MouseButtonDblClick && ev->type() != QEvent::FocusIn) {
+            return false;
+        }
+        if (!obj->isWidgetType()) {
+            return false;
+        }
+        const auto it = m_managers.constFind(static_cast<QWidget *>(obj)->window());
+        if (it == m_managers.constEnd()) {
+            return false;
+        }
+        // Like application event filters, the manager added last sees the event first.
+        // Work on a copy, activating a part may add or delete managers, and this dispatcher.
+        const QList<QPointer<PartManager>> managers(it->cbegin(), it->cend());
+        for (auto rit = managers.crbegin(); rit != managers.crend(); ++rit) {
+            PartManager *manager = *rit;
+            if (manager && manager->eventFilter(obj, ev)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    QSet<PartManager *> allManagers() const
+    {
+        QSet<PartManager *> managers;
+        for (const QList<PartManager *> &list : m_managers) {
+            for (PartManager *manager : list) {
+                managers.insert(manager);
+            }
+        }
+        return managers;
+    }
+
+    ~PartManagerDispatcher() override
+    {
+        qApp->removeEventFilter(this);
+    }
+
+    static PartManagerDispatcher *s_self;
+    QHash<const QWidget *, QList<PartManager *>> m_managers;
+};
+
+PartManagerDispatcher *PartManagerDispatcher::s_self = nullptr;
+
+// Puts \a to in the place of \a from in the tab widget, splitter, stacked widget
+// or layout holding it
+static void replaceWidget(QWidget *from, QWidget *to)
+{
+    QWidget *parent = from->parentWidget();
+    to->setSizePolicy(from->sizePolicy());
+
+    if (auto *splitter = qobject_cast<QSplitter *>(parent)) {
+        splitter->replaceWidget(splitter->indexOf(from), to);
+        return;
+    }
+
+    if (auto *stack = qobject_cast<QStackedWidget *>(parent)) {
+        // The pages of a QTabWidget live in its internal QStackedWidget
+        auto *tabs = qobject_cast<QTabWidget *>(stack->parentWidget());
+        const int tab = tabs ? tabs->indexOf(from) : -1;
+        if (tab >= 0) {
+            const bool current = tabs->currentIndex() == tab;
+            tabs->insertTab(tab, to, tabs->tabIcon(tab), tabs->tabText(tab));
+            tabs->setTabToolTip(tab, tabs->tabToolTip(tab + 1));
+            tabs->setTabWhatsThis(tab, tabs->tabWhatsThis(tab + 1));
+            tabs->setTabEnabled(tab, tabs->isTabEnabled(tab + 1));
+            tabs->removeTab(tab + 1);
+            if (current) {
+                tabs->setCurrentIndex(tab);
+            }
+            return;
+        }
+        const bool current = stack->currentWidget() == from;
+        stack->insertWidget(stack->indexOf(from), to);
+        stack->removeWidget(from);
+        if (current) {
+            stack->setCurrentWidget(to);
+        }
+        return;
+    }
+
+    if (QLayout *layout = parent->layout()) {
+        if (QLayoutItem *item = layout->replaceWidget(from, to)) {
+            delete item;
+            to->setVisible(!from->isHidden());
+            from->hide();
+            return;
+        }
+    }
+
+    to->setParent(parent);
+    to->setGeometry(from->geometry());
+    to->setVisible(!from->isHidden());
+    from->hide();
+}
+
 class PartManagerPrivate
 {
 public:
@@ -32,6 +186,13 @@ public:
         m_activationButtonMask = Qt::LeftButton | Qt::MiddleButton | Qt::RightButton;
         m_reason = PartManager::NoReason;
         m_bIgnoreExplicitFocusRequest = false;
+        m_dispatchMode = PartManager::ApplicationEventFilter;
+        m_activationPolicy = PartManager::ImmediateActivation;
+        m_bApplyingPendingActivation = false;
+        m_activationTimer.setSingleShot(true);
+        m_activationTimer.setInterval(0);
+        m_suspendTimer.setSingleShot(true);
+        m_clock.start();
     }
     ~PartManagerPrivate()
     {
@@ -69,19 +230,274 @@ public:
         return true;
     }
 
+    void indexPart(Part *part)
+    {
+        m_partSet.insert(part);
+        touchPart(part);
+        indexWidget(part, part->widget());
+        // The tree only links managed parts, whichever of them was added first
+        // ### this relies on people using KParts::Factory!
+        Part *parentPart = qobject_cast<Part *>(part->parent());
+        if (parentPart && m_partSet.contains(parentPart)) {
+            linkParts(parentPart, part);
+        }
+        const QObjectList children = part->children();
+        for (QObject *child : children) {
+            Part *childPart = qobject_cast<Part *>(child);
+            if (childPart && m_partSet.contains(childPart)) {
+                linkParts(part, childPart);
+            }
+        }
+    }
+
+    void linkParts(Part *parentPart, Part *childPart)
+    {
+        m_parentParts.insert(childPart, parentPart);
+        m_childParts[parentPart].append(childPart);
+    }
+
+    void unindexPart(Part *part)
+    {
+        m_partSet.remove(part);
+        m_partUsage.remove(part);
+        m_suspendedParts.remove(part);
+        m_restorePriorities.remove(part);
+        unindexWidget(part, part->widget());
+        if (Part *parentPart = m_parentParts.take(part)) {
+            auto it = m_childParts.find(parentPart);
+            if (it != m_childParts.end()) {
+                it->removeAll(part);
+                if (it->isEmpty()) {
+                    m_childParts.erase(it);
+                }
+            }
+        }
+        // The parts nested in it stay managed, at the top of their own trees
+        const QList<Part *> children = m_childParts.take(part);
+        for (Part *child : children) {
+            m_parentParts.remove(child);
+        }
+    }
+
+    // Returns the outermost ancestor of part among the managed parts. complete is set
+    // to false if that ancestor is itself nested in a part which isn't managed.
+    Part *topLevelPart(Part *part, bool *complete) const
+    {
+        Part *top = part;
+        while (Part *parentPart = m_parentParts.value(top)) {
+            top = parentPart;
+        }
+        // A managed parent would be linked
+        *complete = !qobject_cast<Part *>(top->parent());
+        return top;
+    }
+
+    // Records that part is in use now, for the suspension of idle parts
+    void touchPart(Part *part)
+    {
+        m_partUsage[part] = {m_clock.elapsed(), ++m_usageSerial};
+    }
+
+    bool isActive(Part *part) const
+    {
+        if (part == m_activePart) {
+            return true;
+        }
+        if (m_bActivePartPerWindow) {
+            for (const WindowState &state : m_windows) {
+                if (state.activePart == part) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // The parts which may be suspended, least recently used first
+    QList<Part *> suspendableParts() const
+    {
+        QList<Part *> parts;
+        for (auto it = m_partUsage.cbegin(); it != m_partUsage.cend(); ++it) {
+            if (!m_suspendedParts.contains(it.key()) && !isActive(it.key())) {
+                parts.append(it.key());
+            }
+        }
+        std::sort(parts.begin(), parts.end(), [this](Part *a, Part *b) {
+            return m_partUsage.value(a).serial < m_partUsage.value(b).serial;
+        });
+        return parts;
+    }
+
+    void scheduleSuspendCheck()
+    {
+        if (m_suspendTimeout < 0) {
+            m_suspendTimer.stop();
+            return;
+        }
+        const QList<Part *> parts = suspendableParts();
+        if (parts.isEmpty()) {
+            m_suspendTimer.stop();
+            return;
+        }
+        const qint64 deadline = m_partUsage.value(parts.first()).msecs + m_suspendTimeout;
+        m_suspendTimer.start(int(qMax(qint64(0), deadline - m_clock.elapsed())));
+    }
+
+    void collectSubtree(Part *part, QList<Part *> *parts) const
+    {
+        parts->append(part);
+        const QList<Part *> children = m_childParts.value(part);
+        for (Part *child : children) {
+            collectSubtree(child, parts);
+        }
+    }
+
+    void indexWidget(Part *part, const QWidget *widget)
+    {
+        forgetPartAncestors();
+        // If several parts share a widget, the first one added keeps it, as with the list lookup
+        if (widget && !m_widgetParts.contains(widget)) {
+            m_widgetParts.insert(widget, part);
+        }
+    }
+
+    void unindexWidget(Part *part, const QWidget *widget)
+    {
+        forgetPartAncestors();
+        if (!widget || m_widgetParts.value(widget) != part) {
+            return;
+        }
+        m_widgetParts.remove(widget);
+        for (Part *other : std::as_const(m_parts)) {
+            if (other != part && m_partSet.contains(other) && other->widget() == widget) {
+                m_widgetParts.insert(widget, other);
+                break;
+            }
+        }
+    }
+
+    // Remembers where the event filter's walk up the parents of a widget met a part widget
+    struct PartAncestor {
+        QPointer<QWidget> widget; // detects a new widget reusing the address of a deleted one
+        QPointer<QWidget> partWidget; // the nearest widget belonging to a part
+        bool found; // false if the walk ended without meeting a part widget
+    };
+
+    // Only the first result of a walk is kept: above the nearest part widget,
+    // where the walk goes on depends on the position of a click
+    void rememberPartAncestor(QWidget *widget, QWidget *partWidget)
+    {
+        const auto it = m_partAncestors.constFind(widget);
+        if (it != m_partAncestors.constEnd() && it->widget == widget) {
+            return;
+        }
+        if (m_partAncestors.size() >= s_maxPartAncestors) {
+            m_partAncestors.clear();
+        }
+        m_partAncestors.insert(widget, {widget, partWidget, partWidget != nullptr});
+    }
+
+    void forgetPartAncestors()
+    {
+        m_partAncestors.clear();
+        m_partAncestorsStale = false;
+    }
+
+    // Drops the walks that went through a widget which was reparented or changed modality.
+    // Every widget of the application comes by here, so only the widgets the memo or the
+    // manager knows about are looked for; for any other widget which has children the
+    // whole memo is dropped before its next use.
+    void forgetPartAncestors(const QWidget *changed)
+    {
+        if (m_partAncestors.contains(changed) || m_widgetParts.contains(changed)) {
+            m_partAncestors.removeIf([changed](QHash<const QWidget *, PartAncestor>::iterator it) {
+                const QWidget *widget = it.value().widget;
+                return !widget || widget == changed || changed->isAncestorOf(widget);
+            });
+        } else if (changed->findChild<QWidget *>(QString(), Qt::FindDirectChildrenOnly)) {
+            // A widget without children, e.g. one being created, can't be on any remembered walk
+            m_partAncestorsStale = true;
+        }
+    }
+
+    static constexpr qsizetype s_maxPartAncestors = 1024;
+
     Part *m_activePart;
     QWidget *m_activeWidget;
 
     QList<Part *> m_parts;
+    // While addParts() or removeParts() runs, the parts addPart() or removePart() handled
+    QList<Part *> *m_addedParts = nullptr;
+    QList<Part *> *m_removedParts = nullptr;
+    // Lookup structures for the event filter, kept in sync with m_parts
+    QSet<Part *> m_partSet;
+    QHash<const QWidget *, Part *> m_widgetParts;
+    QHash<const QWidget *, PartAncestor> m_partAncestors;
+    bool m_partAncestorsStale = false;
+    // The tree of nested parts, as given by the QObject parents when the parts were added
+    QHash<Part *, Part *> m_parentParts;
+    QHash<Part *, QList<Part *>> m_childParts;
 
     PartManager::SelectionPolicy m_policy;
 
-    QList<const QWidget *> m_managedTopLevelWidgets;
+    // The managed toplevel widgets, with their own active part when activating per window
+    struct WindowState {
+        QPointer<Part> activePart;
+        QPointer<QWidget> activeWidget;
+    };
+    QHash<const QWidget *, WindowState> m_windows;
+    bool m_bActivePartPerWindow = false;
+
+    // The managed window showing the given part or widget, if any
+    const QWidget *windowOf(Part *part, QWidget *widget) const
+    {
+        if (!widget && part) {
+            widget = part->widget();
+        }
+        if (!widget) {
+            return nullptr;
+        }
+        const QWidget *window = widget->window();
+        return m_windows.contains(window) ? window : nullptr;
+    }
     short int m_activationButtonMask;
     bool m_bIgnoreScrollBars;
     bool m_bAllowNestedParts;
     int m_reason;
     bool m_bIgnoreExplicitFocusRequest;
+    PartManager::EventDispatchMode m_dispatchMode;
+    PartManager::ActivationPolicy m_activationPolicy;
+    bool m_bApplyingPendingActivation;
+    // The last activation request, while coalescing
+    QPointer<Part> m_pendingPart;
+    QPointer<QWidget> m_pendingWidget;
+    QTimer m_activationTimer;
+    PartManager::ActivationTimings m_lastActivationTimings;
+
+    // When each part was last active, and in which order
+    struct PartUsage {
+        qint64 msecs = 0;
+        quint64 serial = 0;
+    };
+    QHash<Part *, PartUsage> m_partUsage;
+    quint64 m_usageSerial = 0;
+    QElapsedTimer m_clock;
+    QSet<Part *> m_suspendedParts;
+    int m_suspendTimeout = -1;
+    QTimer m_suspendTimer;
+
+    // What is needed to recreate a hibernated part, by placeholder
+    struct HibernatedPart {
+        KPluginMetaData metaData;
+        QVariantList args;
+        QByteArray state;
+        QPointer<QObject> parent;
+        QString objectName;
+    };
+    QHash<const QWidget *, HibernatedPart> m_hibernatedParts;
+
+    // For restorePendingParts(), higher first
+    QHash<Part *, int> m_restorePriorities;
 };
 
 }
@@ -93,6 +509,8 @@ PartManager::PartManager(QWidget *parent)
     qApp->installEventFilter(this);
 
     d->m_policy = Direct;
+    connect(&d->m_activationTimer, &QTimer::timeout, this, &PartManager::flushPendingActivation);
+    connect(&d->m_suspendTimer, &QTimer::timeout, this, &PartManager::suspendIdleParts);
 
     addManagedTopLevelWidget(parent);
 }
@@ -104,13 +522,16 @@ PartManager::PartManager(QWidget *topLevel, QObject *parent)
     qApp->installEventFilter(this);
 
     d->m_policy = Direct;
+    connect(&d->m_activationTimer, &QTimer::timeout, this, &PartManager::flushPendingActivation);
+    connect(&d->m_suspendTimer, &QTimer::timeout, this, &PartManager::suspendIdleParts);
 
     addManagedTopLevelWidget(topLevel);
 }
 
 PartManager::~PartManager()
 {
-    for (const QWidget *w : std::as_const(d->m_managedTopLevelWidgets)) {
+    const QList<const QWidget *> windows = d->m_windows.keys();
+    for (const QWidget *w : windows) {
         disconnect(w, &QWidget::destroyed, this, &PartManager::slotManagedTopLevelWidgetDestroyed);
     }
 
@@ -119,7 +540,13 @@ PartManager::~PartManager()
     }
 
     // core dumps ... setActivePart( 0 );
-    qApp->removeEventFilter(this);
+    if (d->m_dispatchMode == SharedDispatcher) {
+        for (const QWidget *w : windows) {
+            PartManagerDispatcher::removeManager(w, this);
+        }
+    } else {
+        qApp->removeEventFilter(this);
+    }
 }
 
 void PartManager::setSelectionPolicy(SelectionPolicy policy)
@@ -145,6 +572,7 @@ bool PartManager::allowNestedParts() const
 void PartManager::setIgnoreScrollBars(bool ignore)
 {
     d->m_bIgnoreScrollBars = ignore;
+    d->forgetPartAncestors();
 }
 
 bool PartManager::ignoreScrollBars() const
@@ -162,8 +590,91 @@ short int PartManager::activationButtonMask() const
     return d->m_activationButtonMask;
 }
 
+void PartManager::setEventDispatchMode(EventDispatchMode mode)
+{
+    if (d->m_dispatchMode == mode) {
+        return;
+    }
+    d->m_dispatchMode = mode;
+
+    const QList<const QWidget *> windows = d->m_windows.keys();
+    if (mode == SharedDispatcher) {
+        qApp->removeEventFilter(this);
+        for (const QWidget *w : windows) {
+            PartManagerDispatcher::addManager(w, this);
+        }
+    } else {
+        for (const QWidget *w : windows) {
+            PartManagerDispatcher::removeManager(w, this);
+        }
+        qApp->installEventFilter(this);
+    }
+}
+
+PartManager::EventDispatchMode PartManager::eventDispatchMode() const
+{
+    return d->m_dispatchMode;
+}
+
+void PartManager::setActivationPolicy(ActivationPolicy policy)
+{
+    d->m_activationPolicy = policy;
+    if (policy == ImmediateActivation) {
+        flushPendingActivation();
+    }
+}
+
+PartManager::ActivationPolicy PartManager::activationPolicy() const
+{
+    return d->m_activationPolicy;
+}
+
+void PartManager::setActivationCoalescingInterval(int msec)
+{
+    d->m_activationTimer.setInterval(msec);
+}
+
+int PartManager::activationCoalescingInterval() const
+{
+    return d->m_activationTimer.interval();
+}
+
+bool PartManager::hasPendingActivation() const
+{
+    return !d->m_pendingPart.isNull();
+}
+
+void PartManager::flushPendingActivation()
+{
+    Part *part = d->m_pendingPart;
+    QWidget *widget = d->m_pendingWidget;
+    cancelPendingActivation();
+
+    // The part may have been removed in the meantime
+    if (!part || !d->m_partSet.contains(part)) {
+        return;
+    }
+    d->m_bApplyingPendingActivation = true;
+    setActivePart(part, widget);
+    d->m_bApplyingPendingActivation = false;
+}
+
+void PartManager::cancelPendingActivation()
+{
+    d->m_activationTimer.stop();
+    d->m_pendingPart = nullptr;
+    d->m_pendingWidget = nullptr;
+}
+
 bool PartManager::eventFilter(QObject *obj, QEvent *ev)
 {
+    if (ev->type() == QEvent::ParentChange || ev->type() == QEvent::ModalityChange) {
+        if (obj->isWidgetType() && !d->m_partAncestors.isEmpty()) {
+            d->forgetPartAncestors(static_cast<QWidget *>(obj));
+        }
+        return false;
+    }
+
     if (ev->type() != QEvent::MouseButtonPress && ev->type() != QEvent::MouseButtonDblClick && ev->type() != QEvent::FocusIn) {
         return false;
     }
@@ -189,18 +700,57 @@ bool PartManager::eventFilter(QObject *obj, QEvent *ev)
         }
     }
 
+    // Clicking or focusing the placeholder of a hibernated part brings the part back
+    if (d->m_hibernatedParts.contains(w) && d->m_windows.contains(w->topLevelWidget())) {
+        ReadOnlyPart *restored = restorePart(w);
+        if (!restored) {
+            return false;
+        }
+        d->setReason(ev);
+        setActivePart(restored);
+        d->m_reason = NoReason;
+        // The placeholder is about to go, the click or focus belongs to the part
+        if (QWidget *widget = restored->widget()) {
+            widget->setFocus(Qt::OtherFocusReason);
+        }
+        return true;
+    }
+
+    // Repeated focus events in the same widget skip the walk up to the nearest part widget.
+    // Mouse events go through hitTest(), which may claim any widget on the way, so they
+    // only fill the memo.
+    QWidget *const origin = w;
+    if (d->m_partAncestorsStale) {
+        d->forgetPartAncestors();
+    }
+    const auto cached = mev ? d->m_partAncestors.constEnd() : d->m_partAncestors.constFind(origin);
+    if (cached != d->m_partAncestors.constEnd() && cached->widget == origin) {
+        if (!cached->found) {
+            return false;
+        }
+        if (cached->partWidget) {
+            w = cached->partWidget;
+        }
+    }
+
     Part *part;
     while (w) {
         QPoint pos;
 
-        if (!d->m_managedTopLevelWidgets.contains(w->topLevelWidget())) {
+        if (!d->m_windows.contains(w->topLevelWidget())) {
+            d->rememberPartAncestor(origin, nullptr);
             return false;
         }
 
         if (d->m_bIgnoreScrollBars && ::qobject_cast<QScrollBar *>(w)) {
+            d->rememberPartAncestor(origin, nullptr);
             return false;
         }
 
+        if (d->m_widgetParts.contains(w)) {
+            d->rememberPartAncestor(origin, w);
+        }
+
         if (mev) { // mouse press or mouse double-click event
             pos = mev->globalPosition().toPoint();
             part = findPartFromWidget(w, pos);
@@ -256,20 +806,34 @@ bool PartManager::eventFilter(QObject *obj, QEvent *ev)
         if (w && (((w->windowFlags() & Qt::Dialog) && w->isModal()) || (w->windowFlags() & Qt::Popup) || (w->windowFlags() & Qt::Tool))) {
             qCDebug(KPARTSLOG) << "No part made active although" << obj->objectName() << "/" << obj->metaObject()->className() << "got event - loop aborted";
 
+            d->rememberPartAncestor(origin, nullptr);
             return false;
         }
     }
 
     qCDebug(KPARTSLOG) << "No part made active although" << obj->objectName() << "/" << obj->metaObject()->className() << "got event - loop aborted";
 
+    d->rememberPartAncestor(origin, nullptr);
     return false;
 }
 
 Part *PartManager::findPartFromWidget(QWidget *widget, const QPoint &pos)
 {
+    // The part owning the widget answers with the default hitTest(), ask it first
+    Part *owner = d->m_widgetParts.value(widget);
+    if (owner) {
+        Part *part = owner->hitTest(widget, pos);
+        if (part && d->m_partSet.contains(part)) {
+            return part;
+        }
+    }
+    // Parts reimplementing hitTest() may claim widgets they don't own
     for (auto *p : std::as_const(d->m_parts)) {
+        if (p == owner) {
+            continue;
+        }
         Part *part = p->hitTest(widget, pos);
-        if (part && d->m_parts.contains(part)) {
+        if (part && d->m_partSet.contains(part)) {
             return part;
         }
     }
@@ -278,12 +842,13 @@ Part *PartManager::findPartFromWidget(QWidget *widget, const QPoint &pos)
 
 Part *PartManager::findPartFromWidget(QWidget *widget)
 {
-    for (auto *part : std::as_const(d->m_parts)) {
-        if (widget == part->widget()) {
-            return part;
-        }
-    }
-    return nullptr;
+    return d->m_widgetParts.value(widget);
+}
+
+void PartManager::partWidgetChanged(Part *part, QWidget *oldWidget)
+{
+    d->unindexWidget(part, oldWidget);
+    d->indexWidget(part, part->widget());
 }
 
 void PartManager::addPart(Part *part, bool setActive)
@@ -291,65 +856,136 @@ void PartManager::addPart(Part *part, bool setActive)
     Q_ASSERT(part);
 
     // don't add parts more than once :)
-    if (d->m_parts.contains(part)) {
+    if (d->m_partSet.contains(part)) {
         qCWarning(KPARTSLOG) << part << " already added";
         return;
     }
 
     d->m_parts.append(part);
+    d->indexPart(part);
 
     part->setManager(this);
 
     if (setActive) {
-        setActivePart(part);
-
-        if (QWidget *w = part->widget()) {
-            // Prevent focus problems
-            if (w->focusPolicy() == Qt::NoFocus) {
-                qCWarning(KPARTSLOG) << "Part '" << part->objectName() << "' has a widget " << w->objectName()
-                                     << "with a focus policy of NoFocus. It should have at least a"
-                                     << "ClickFocus policy, for part activation to work well.";
-            }
-            if (part->widget() && part->widget()->focusPolicy() == Qt::TabFocus) {
-                qCWarning(KPARTSLOG) << "Part '" << part->objectName() << "' has a widget " << w->objectName()
-                                     << "with a focus policy of TabFocus. It should have at least a"
-                                     << "ClickFocus policy, for part activation to work well.";
-            }
-            w->setFocus();
-            w->show();
-        }
+        activateAddedPart(part);
+    }
+    // addParts() emits once all its parts are added
+    if (d->m_addedParts) {
+        d->m_addedParts->append(part);
+        return;
     }
     Q_EMIT partAdded(part);
 }
 
+void PartManager::activateAddedPart(Part *part)
+{
+    setActivePart(part);
+
+    if (QWidget *w = part->widget()) {
+        // Prevent focus problems
+        if (w->focusPolicy() == Qt::NoFocus) {
+            qCWarning(KPARTSLOG) << "Part '" << part->objectName() << "' has a widget " << w->objectName()
+                                 << "with a focus policy of NoFocus. It should have at least a"
+                                 << "ClickFocus policy, for part activation to work well.";
+        }
+        if (part->widget() && part->widget()->focusPolicy() == Qt::TabFocus) {
+            qCWarning(KPARTSLOG) << "Part '" << part->objectName() << "' has a widget " << w->objectName()
+                                 << "with a focus policy of TabFocus. It should have at least a"
+                                 << "ClickFocus policy, for part activation to work well.";
+        }
+        w->setFocus();
+        w->show();
+    }
+}
+
+void PartManager::addParts(const QList<Part *> &parts, Part *activate)
+{
+    // Going through addPart() keeps its reimplementations working
+    QList<Part *> added;
+    added.reserve(parts.size());
+    d->m_addedParts = &added;
+    for (Part *part : parts) {
+        addPart(part, false);
+    }
+    d->m_addedParts = nullptr;
+
+    if (activate) {
+        if (d->m_partSet.contains(activate)) {
+            activateAddedPart(activate);
+        } else {
+            qCWarning(KPARTSLOG) << "addParts: not activating" << activate << "which isn't managed";
+        }
+    }
+
+    for (Part *part : std::as_const(added)) {
+        Q_EMIT partAdded(part);
+    }
+}
+
 void PartManager::removePart(Part *part)
 {
-    if (!d->m_parts.contains(part)) {
+    if (!d->m_partSet.contains(part)) {
+        return;
+    }
+
+    d->unindexPart(part);
+    part->setManager(nullptr);
+
+    // removeParts() updates the list, emits and deactivates once for all its parts
+    if (d->m_removedParts) {
+        d->m_removedParts->append(part);
         return;
     }
 
     const int nb = d->m_parts.removeAll(part);
     Q_ASSERT(nb == 1);
     Q_UNUSED(nb); // no warning in release mode
-    part->setManager(nullptr);
 
     Q_EMIT partRemoved(part);
 
     if (part == d->m_activePart) {
         setActivePart(nullptr);
     }
+    deactivateInOtherWindows({part});
+}
+
+void PartManager::removeParts(const QList<Part *> &parts)
+{
+    // Going through removePart() keeps its reimplementations working
+    QList<Part *> removed;
+    removed.reserve(parts.size());
+    d->m_removedParts = &removed;
+    for (Part *part : parts) {
+        removePart(part);
+    }
+    d->m_removedParts = nullptr;
+    const bool removedActivePart = removed.contains(d->m_activePart);
+    // A single pass over the list, unindexed parts are the ones to remove
+    d->m_parts.removeIf([this](Part *part) {
+        return !d->m_partSet.contains(part);
+    });
+
+    for (Part *part : std::as_const(removed)) {
+        Q_EMIT partRemoved(part);
+    }
+
+    if (removedActivePart) {
+        setActivePart(nullptr);
+    }
+    deactivateInOtherWindows(removed);
 }
 
 void PartManager::replacePart(Part *oldPart, Part *newPart, bool setActive)
 {
     // qCDebug(KPARTSLOG) << "replacePart" << oldPart->name() << "->" << newPart->name() << "setActive=" << setActive;
     // This methods does exactly removePart + addPart but without calling setActivePart(0) in between
-    if (!d->m_parts.contains(oldPart)) {
+    if (!d->m_partSet.contains(oldPart)) {
         qFatal("Can't remove part %s, not in KPartManager's list.", oldPart->objectName().toLocal8Bit().constData());
         return;
     }
 
     d->m_parts.removeAll(oldPart);
+    d->unindexPart(oldPart);
     oldPart->setManager(nullptr);
 
     Q_EMIT partRemoved(oldPart);
@@ -359,20 +995,58 @@ void PartManager::replacePart(Part *oldPart, Part *newPart, bool setActive)
 
 void PartManager::setActivePart(Part *part, QWidget *widget)
 {
-    if (part && !d->m_parts.contains(part)) {
+    if (part && !d->m_partSet.contains(part)) {
         qCWarning(KPARTSLOG) << "trying to activate a non-registered part!" << part->objectName();
         return; // don't allow someone call setActivePart with a part we don't know about
     }
 
-    // check whether nested parts are disallowed and activate the top parent part then, by traversing the
-    // tree recursively (Simon)
+    // check whether nested parts are disallowed and activate the top parent part then
     if (part && !d->m_bAllowNestedParts) {
-        QObject *parentPart = part->parent(); // ### this relies on people using KParts::Factory!
-        KParts::Part *parPart = ::qobject_cast<KParts::Part *>(parentPart);
-        if (parPart) {
-            setActivePart(parPart, parPart->widget());
+        bool complete;
+        Part *topPart = d->topLevelPart(part, &complete);
+        if (!complete) {
+            qCWarning(KPARTSLOG) << "trying to activate a part nested in a non-registered part!" << part->objectName();
+            return;
+        }
+        if (topPart != part) {
+            setActivePart(topPart, topPart->widget());
+            return;
+        }
+    }
+
+    if (d->m_activationPolicy == CoalescedActivation && !d->m_bApplyingPendingActivation) {
+        if (part) {
+            // Only the last request counts, intermediate parts are never activated
+            d->m_pendingPart = part;
+            d->m_pendingWidget = widget;
+            if (!d->m_activationTimer.isActive()) {
+                d->m_activationTimer.start();
+            }
             return;
         }
+        // Deactivation isn't delayed, the active part may be going away
+        cancelPendingActivation();
+    }
+
+    // With an active part per window, the transition happens within the window of the part
+    const QWidget *window = nullptr;
+    Part *const currentPart = d->m_activePart;
+    if (d->m_bActivePartPerWindow) {
+        window = part ? d->windowOf(part, widget) : d->windowOf(d->m_activePart, d->m_activeWidget);
+        if (window) {
+            const PartManagerPrivate::WindowState state = d->m_windows.value(window);
+            // No window keeps a current part outside the managed windows active
+            if (currentPart && currentPart != state.activePart && !d->windowOf(currentPart, d->m_activeWidget)) {
+                PartActivateEvent ev(false, currentPart, d->m_activeWidget);
+                QApplication::sendEvent(currentPart, &ev);
+                if (d->m_activeWidget) {
+                    disconnect(d->m_activeWidget, &QWidget::destroyed, this, &PartManager::slotWidgetDestroyed);
+                    QApplication::sendEvent(d->m_activeWidget, &ev);
+                }
+            }
+            d->m_activePart = state.activePart;
+            d->m_activeWidget = state.activeWidget;
+        }
     }
 
     qCDebug(KPARTSLOG) << "PartManager::setActivePart d->m_activePart=" << d->m_activePart << "<->part=" << part << "d->m_activeWidget=" << d->m_activeWidget
@@ -380,15 +1054,32 @@ void PartManager::setActivePart(Part *part, QWidget *widget)
 
     // don't activate twice
     if (d->m_activePart && part && d->m_activePart == part && (!widget || d->m_activeWidget == widget)) {
+        // Already active in its window, it only becomes the current part
+        if (currentPart != part) {
+            Q_EMIT activePartChanged(d->m_activePart);
+        }
         return;
     }
 
     KParts::Part *oldActivePart = d->m_activePart;
     QWidget *oldActiveWidget = d->m_activeWidget;
 
+    // A part outside every managed window still replaces the current part, whose window loses it
+    const QWidget *oldWindow = nullptr;
+    if (d->m_bActivePartPerWindow && !window && oldActivePart) {
+        oldWindow = d->windowOf(oldActivePart, oldActiveWidget);
+        if (oldWindow && d->m_windows.value(oldWindow).activePart != oldActivePart) {
+            oldWindow = nullptr;
+        }
+    }
+
     d->m_activePart = part;
     d->m_activeWidget = widget;
 
+    ActivationTimings timings;
+    QElapsedTimer timer;
+    timer.start();
+
     if (oldActivePart) {
         KParts::Part *savedActivePart = part;
         QWidget *savedActiveWidget = widget;
@@ -402,13 +1093,27 @@ void PartManager::setActivePart(Part *part, QWidget *widget)
 
         d->m_activePart = savedActivePart;
         d->m_activeWidget = savedActiveWidget;
+
+        if (d->m_partUsage.contains(oldActivePart)) {
+            d->touchPart(oldActivePart);
+        }
     }
+    timings.deactivationNsecs = timer.nsecsElapsed();
 
     if (d->m_activePart) {
         if (!widget) {
             d->m_activeWidget = part->widget();
         }
 
+        d->touchPart(d->m_activePart);
+        if (d->m_suspendedParts.contains(d->m_activePart)) {
+            resumePart(d->m_activePart);
+        }
+        // A view restored lazily loads its document when first activated
+        if (NavigationExtension *extension = NavigationExtension::childObject(d->m_activePart)) {
+            extension->restorePendingState();
+        }
+
         PartActivateEvent ev(true, d->m_activePart, d->m_activeWidget);
         QApplication::sendEvent(d->m_activePart, &ev);
         if (d->m_activeWidget) {
@@ -419,9 +1124,360 @@ void PartManager::setActivePart(Part *part, QWidget *widget)
     // Set the new active instance
     // setActiveComponent(d->m_activePart ? d->m_activePart->componentData() : KComponentData::mainComponent());
 
+    timings.activationNsecs = timer.nsecsElapsed() - timings.deactivationNsecs;
+
     qCDebug(KPARTSLOG) << this << "emitting activePartChanged" << d->m_activePart;
 
+    if (window && d->m_windows.contains(window)) {
+        PartManagerPrivate::WindowState &state = d->m_windows[window];
+        state.activePart = d->m_activePart;
+        state.activeWidget = d->m_activeWidget;
+    }
+    if (oldWindow && d->m_windows.contains(oldWindow)) {
+        d->m_windows[oldWindow] = {};
+    }
+
     Q_EMIT activePartChanged(d->m_activePart);
+    if (window) {
+        Q_EMIT windowActivePartChanged(window, d->m_activePart);
+    }
+    if (oldWindow) {
+        Q_EMIT windowActivePartChanged(oldWindow, nullptr);
+    }
+
+    timings.notificationNsecs = timer.nsecsElapsed() - timings.deactivationNsecs - timings.activationNsecs;
+    d->m_lastActivationTimings = timings;
+    d->scheduleSuspendCheck();
+    qCDebug(KPARTSLOG) << this << "activation of" << d->m_activePart << "took" << timer.nsecsElapsed() / 1000 << "us: deactivation"
+                       << timings.deactivationNsecs / 1000 << "us, activation" << timings.activationNsecs / 1000 << "us, activePartChanged receivers"
+                       << timings.notificationNsecs / 1000 << "us";
+}
+
+PartManager::ActivationTimings PartManager::lastActivationTimings() const
+{
+    return d->m_lastActivationTimings;
+}
+
+void PartManager::setSuspendTimeout(int msec)
+{
+    d->m_suspendTimeout = msec;
+    d->scheduleSuspendCheck();
+}
+
+int PartManager::suspendTimeout() const
+{
+    return d->m_suspendTimeout;
+}
+
+bool PartManager::isPartSuspended(Part *part) const
+{
+    return d->m_suspendedParts.contains(part);
+}
+
+void PartManager::suspendPart(Part *part)
+{
+    if (!d->m_partSet.contains(part) || d->m_suspendedParts.contains(part) || d->isActive(part)) {
+        return;
+    }
+    d->m_suspendedParts.insert(part);
+
+    PartSuspendEvent ev(true, part);
+    QApplication::sendEvent(part, &ev);
+    if (QWidget *w = part->widget()) {
+        QApplication::sendEvent(w, &ev);
+    }
+    Q_EMIT partSuspended(part);
+}
+
+void PartManager::resumePart(Part *part)
+{
+    if (!d->m_suspendedParts.remove(part)) {
+        return;
+    }
+    d->touchPart(part);
+
+    PartSuspendEvent ev(false, part);
+    QApplication::sendEvent(part, &ev);
+    if (QWidget *w = part->widget()) {
+        QApplication::sendEvent(w, &ev);
+    }
+    Q_EMIT partResumed(part);
+    d->scheduleSuspendCheck();
+}
+
+int PartManager::suspendLeastRecentlyUsedParts(int count)
+{
+    const QList<Part *> parts = d->suspendableParts();
+    int suspended = 0;
+    for (Part *part : parts) {
+        if (suspended >= count) {
+            break;
+        }
+        // Receivers of partSuspended() may remove parts
+        if (d->m_partSet.contains(part)) {
+            suspendPart(part);
+            ++suspended;
+        }
+    }
+    d->scheduleSuspendCheck();
+    return suspended;
+}
+
+void PartManager::suspendIdleParts()
+{
+    const qint64 now = d->m_clock.elapsed();
+    const QList<Part *> parts = d->suspendableParts();
+    for (Part *part : parts) {
+        if (!d->m_partSet.contains(part)) {
+            continue;
+        }
+        if (now - d->m_partUsage.value(part).msecs < d->m_suspendTimeout) {
+            break; // the others were used even more recently
+        }
+        suspendPart(part);
+    }
+    d->scheduleSuspendCheck();
+}
+
+QWidget *PartManager::hibernatePart(ReadOnlyPart *part, const QVariantList &args)
+{
+    if (!d->m_partSet.contains(part) || d->isActive(part)) {
+        return nullptr;
+    }
+    NavigationExtension *extension = NavigationExtension::childObject(part);
+    QWidget *widget = part->widget();
+    if (!extension || !widget || !widget->parentWidget() || !part->metaData().isValid()) {
+        return nullptr;
+    }
+    // Nested parts would have to be recreated together with their parent
+    if (d->m_parentParts.contains(part) || d->m_childParts.contains(part)) {
+        return nullptr;
+    }
+    // Unsaved changes can't be recreated from the URL
+    if (auto *rwPart = qobject_cast<ReadWritePart *>(part); rwPart && rwPart->isModified()) {
+        return nullptr;
+    }
+
+    PartManagerPrivate::HibernatedPart hibernated;
+    hibernated.metaData = part->metaData();
+    hibernated.args = args;
+    hibernated.parent = part->parent();
+    hibernated.objectName = part->objectName();
+    {
+        QDataStream stream(&hibernated.state, QIODevice::WriteOnly);
+        extension->saveState(stream);
+    }
+
+    QWidget *placeholder = new QWidget(widget->parentWidget());
+    placeholder->setFocusPolicy(Qt::ClickFocus);
+    replaceWidget(widget, placeholder);
+    d->m_hibernatedParts.insert(placeholder, hibernated);
+    connect(placeholder, &QObject::destroyed, this, [this, placeholder]() {
+        d->m_hibernatedParts.remove(placeholder);
+    });
+
+    qCDebug(KPARTSLOG) << "Hibernating part" << part << hibernated.metaData.pluginId();
+    Q_EMIT partHibernated(part, placeholder);
+
+    removePart(part);
+    part->deleteLater();
+    widget->deleteLater();
+    return placeholder;
+}
+
+ReadOnlyPart *PartManager::restorePart(QWidget *placeholder)
+{
+    const auto it = d->m_hibernatedParts.constFind(placeholder);
+    if (it == d->m_hibernatedParts.constEnd()) {
+        return nullptr;
+    }
+    const PartManagerPrivate::HibernatedPart hibernated = *it;
+
+    const auto result = PartLoader::instantiatePart<ReadOnlyPart>(hibernated.metaData, placeholder->parentWidget(), hibernated.parent, hibernated.args);
+    if (!result) {
+        // Keep the placeholder, a later click retries
+        qCWarning(KPARTSLOG) << "Could not restore the hibernated part" << hibernated.metaData.pluginId() << result.errorString;
+        return nullptr;
+    }
+    d->m_hibernatedParts.remove(placeholder);
+
+    ReadOnlyPart *part = result.plugin;
+    part->setObjectName(hibernated.objectName);
+    if (QWidget *widget = part->widget()) {
+        replaceWidget(placeholder, widget);
+    }
+    addPart(part, false);
+
+    if (NavigationExtension *extension = NavigationExtension::childObject(part)) {
+        QDataStream stream(hibernated.state);
+        extension->restoreState(stream);
+    }
+
+    qCDebug(KPARTSLOG) << "Restored part" << part << hibernated.metaData.pluginId();
+    Q_EMIT partRestored(placeholder, part);
+    placeholder->deleteLater();
+    return part;
+}
+
+void PartManager::setRestorePriority(Part *part, int priority)
+{
+    if (d->m_partSet.contains(part)) {
+        d->m_restorePriorities.insert(part, priority);
+    }
+}
+
+int PartManager::restorePriority(Part *part) const
+{
+    return d->m_restorePriorities.value(part);
+}
+
+int PartManager::restorePendingParts(int count)
+{
+    struct Pending {
+        NavigationExtension *extension;
+        bool visible;
+        int priority;
+    };
+    QList<Pending> pending;
+    for (Part *part : std::as_const(d->m_parts)) {
+        NavigationExtension *extension = NavigationExtension::childObject(part);
+        if (extension && extension->isRestorePending()) {
+            const bool visible = part->widget() && part->widget()->isVisible();
+            pending.append({extension, visible, d->m_restorePriorities.value(part)});
+        }
+    }
+    // Visible views first, then by priority, then in the order they were added
+    std::stable_sort(pending.begin(), pending.end(), [](const Pending &a, const Pending &b) {
+        if (a.visible != b.visible) {
+            return a.visible;
+        }
+        return a.priority > b.priority;
+    });
+
+    if (count >= 0 && pending.count() > count) {
+        pending.resize(count);
+    }
+    QList<QPointer<NavigationExtension>> extensions;
+    for (const Pending &entry : std::as_const(pending)) {
+        extensions.append(entry.extension);
+    }
+    // Opening a URL may delete other parts
+    int restored = 0;
+    for (NavigationExtension *extension : std::as_const(extensions)) {
+        if (extension && extension->isRestorePending()) {
+            extension->restorePendingState();
+            ++restored;
+        }
+    }
+    return restored;
+}
+
+bool PartManager::isHibernatedPlaceholder(const QWidget *widget) const
+{
+    return d->m_hibernatedParts.contains(widget);
+}
+
+Part *PartManager::topLevelPart(Part *part) const
+{
+    if (!d->m_partSet.contains(part)) {
+        return nullptr;
+    }
+    bool complete;
+    return d->topLevelPart(part, &complete);
+}
+
+QList<Part *> PartManager::childParts(Part *part) const
+{
+    return d->m_childParts.value(part);
+}
+
+QList<Part *> PartManager::subtree(Part *part) const
+{
+    QList<Part *> parts;
+    if (d->m_partSet.contains(part)) {
+        d->collectSubtree(part, &parts);
+    }
+    return parts;
+}
+
+void PartManager::deactivateSubtree(Part *part)
+{
+    const QList<Part *> parts = subtree(part);
+    if (d->m_pendingPart && parts.contains(d->m_pendingPart.data())) {
+        cancelPendingActivation();
+    }
+    if (d->m_activePart && parts.contains(d->m_activePart)) {
+        setActivePart(nullptr);
+    }
+    deactivateInOtherWindows(parts);
+}
+
+void PartManager::removeSubtree(Part *part)
+{
+    removeParts(subtree(part));
+}
+
+void PartManager::setActivePartPerWindow(bool perWindow)
+{
+    if (d->m_bActivePartPerWindow == perWindow) {
+        return;
+    }
+    d->m_bActivePartPerWindow = perWindow;
+
+    for (auto it = d->m_windows.begin(); it != d->m_windows.end(); ++it) {
+        it->activePart = nullptr;
+        it->activeWidget = nullptr;
+    }
+    if (perWindow) {
+        if (const QWidget *window = d->windowOf(d->m_activePart, d->m_activeWidget)) {
+            d->m_windows[window] = {d->m_activePart, d->m_activeWidget};
+        }
+    }
+}
+
+bool PartManager::isActivePartPerWindow() const
+{
+    return d->m_bActivePartPerWindow;
+}
+
+Part *PartManager::windowActivePart(const QWidget *window) const
+{
+    if (d->m_bActivePartPerWindow) {
+        return d->m_windows.value(window).activePart;
+    }
+    return d->windowOf(d->m_activePart, d->m_activeWidget) == window ? d->m_activePart : nullptr;
+}
+
+void PartManager::deactivateInOtherWindows(const QList<Part *> &parts)
+{
+    if (!d->m_bActivePartPerWindow) {
+        return;
+    }
+    // Signal receivers may change the windows, collect them first
+    QList<const QWidget *> windows;
+    for (auto it = d->m_windows.cbegin(); it != d->m_windows.cend(); ++it) {
+        if (it->activePart && parts.contains(it->activePart.data())) {
+            windows.append(it.key());
+        }
+    }
+    for (const QWidget *window : std::as_const(windows)) {
+        auto it = d->m_windows.find(window);
+        if (it == d->m_windows.end() || !it->activePart) {
+            continue;
+        }
+        Part *part = it->activePart;
+        QWidget *widget = it->activeWidget;
+        it->activePart = nullptr;
+        it->activeWidget = nullptr;
+
+        PartActivateEvent ev(false, part, widget);
+        QApplication::sendEvent(part, &ev);
+        if (widget) {
+            disconnect(widget, &QWidget::destroyed, this, &PartManager::slotWidgetDestroyed);
+            QApplication::sendEvent(widget, &ev);
+        }
+        Q_EMIT windowActivePartChanged(window, nullptr);
+    }
 }
 
 Part *PartManager::activePart() const
@@ -460,17 +1516,25 @@ void PartManager::addManagedTopLevelWidget(const QWidget *topLevel)
         return;
     }
 
-    if (d->m_managedTopLevelWidgets.contains(topLevel)) {
+    if (d->m_windows.contains(topLevel)) {
         return;
     }
 
-    d->m_managedTopLevelWidgets.append(topLevel);
+    d->m_windows.insert(topLevel, {});
+    d->forgetPartAncestors();
     connect(topLevel, &QWidget::destroyed, this, &PartManager::slotManagedTopLevelWidgetDestroyed);
+
+    if (d->m_dispatchMode == SharedDispatcher) {
+        PartManagerDispatcher::addManager(topLevel, this);
+    }
 }
 
 void PartManager::removeManagedTopLevelWidget(const QWidget *topLevel)
 {
-    d->m_managedTopLevelWidgets.removeAll(topLevel);
+    d->forgetPartAncestors();
+    if (d->m_windows.remove(topLevel) && d->m_dispatchMode == SharedDispatcher) {
+        PartManagerDispatcher::removeManager(topLevel, this);
+    }
 }
 
 void PartManager::slotManagedTopLevelWidgetDestroyed()
@@ -11,12 +11,14 @@
 
 #include <kparts/kparts_export.h>
 
+#include <QVariant>
 #include <QWidget>
 #include <memory>
 
 namespace KParts
 {
 class Part;
+class ReadOnlyPart;
 
 class PartManagerPrivate;
 
@@ -75,6 +77,59 @@ public:
      */
     enum Reason { ReasonLeftClick = 100, ReasonMidClick, ReasonRightClick, NoReason };
 
+    /*!
+     * How the part manager receives the events it uses for part activation.
+     *
+     * \value ApplicationEventFilter The part manager installs itself as an event filter
+     *        on the application, so it sees every event of every object. This is the default.
+     * \value SharedDispatcher All part managers using this mode share a single application
+     *        event filter, which only forwards mouse press and focus events for widgets
+     *        inside a managed toplevel widget to the part managers managing it.
+     *        Recommended for applications with many part managers.
+     *
+     * \since 6.30
+     */
+    enum EventDispatchMode { ApplicationEventFilter, SharedDispatcher };
+    Q_ENUM(EventDispatchMode)
+
+    /*!
+     * When activation requests take effect.
+     *
+     * \value ImmediateActivation setActivePart() sends the activation events and emits
+     *        activePartChanged() right away. This is the default.
+     * \value CoalescedActivation setActivePart() records the request, and only the last
+     *        request made within activationCoalescingInterval() is carried out. Deactivating
+     *        the active part, e.g. when it is removed, still happens immediately.
+     *
+     * \since 6.30
+     */
+    enum ActivationPolicy { ImmediateActivation, CoalescedActivation };
+    Q_ENUM(ActivationPolicy)
+
+    /*!
+     * \struct KParts::PartManager::ActivationTimings
+     * \inmodule KParts
+     *
+     * \brief Durations, in nanoseconds, of the phases of an activation change.
+     *
+     * \since 6.30
+     */
+    struct ActivationTimings {
+        /*!
+         * Sending the deactivation PartActivateEvent to the previous part and its widget.
+         */
+        qint64 deactivationNsecs = 0;
+        /*!
+         * Sending the activation PartActivateEvent to the new part and its widget.
+         */
+        qint64 activationNsecs = 0;
+        /*!
+         * Emitting activePartChanged(), i.e. the time spent by its receivers,
+         * typically MainWindow::createGUI(). See MainWindow::guiMergeStatistics().
+         */
+        qint64 notificationNsecs = 0;
+    };
+
     /*!
      * Constructs a part manager.
      *
@@ -148,6 +203,65 @@ public:
      */
     short int activationButtonMask() const;
 
+    /*!
+     * Sets how the part manager receives activation events.
+     *
+     * \since 6.30
+     */
+    void setEventDispatchMode(EventDispatchMode mode);
+    /*!
+     * \sa setEventDispatchMode
+     * \since 6.30
+     */
+    EventDispatchMode eventDispatchMode() const;
+
+    /*!
+     * Sets when activation requests take effect.
+     *
+     * Coalescing avoids rebuilding the GUI for every intermediate part when
+     * the focus moves quickly across parts, e.g. when tabbing through a split view.
+     * Switching back to ImmediateActivation carries out a pending request.
+     *
+     * \since 6.30
+     */
+    void setActivationPolicy(ActivationPolicy policy);
+    /*!
+     * \sa setActivationPolicy
+     * \since 6.30
+     */
+    ActivationPolicy activationPolicy() const;
+
+    /*!
+     * Sets how long, in milliseconds, activation requests are collected before the
+     * last one is carried out, when the activation policy is CoalescedActivation.
+     *
+     * The default of 0 coalesces the requests made in the same event loop iteration.
+     *
+     * \since 6.30
+     */
+    void setActivationCoalescingInterval(int msec);
+    /*!
+     * \sa setActivationCoalescingInterval
+     * \since 6.30
+     */
+    int activationCoalescingInterval() const;
+
+    /*!
+     * Returns true if an activation request is waiting to be carried out.
+     *
+     * activePart() returns the part active before that request until then.
+     *
+     * \since 6.30
+     */
+    bool hasPendingActivation() const;
+
+    /*!
+     * Carries out a pending activation request right away, if any.
+     *
+     * \since 6.30
+     */
+    void flushPendingActivation();
+
     bool eventFilter(QObject *obj, QEvent *ev) override;
 
     /*!
@@ -171,6 +285,34 @@ public:
      */
     virtual void replacePart(Part *oldPart, Part *newPart, bool setActive = true);
 
+    /*!
+     * Adds several parts to the manager at once, for instance when restoring a session.
+     *
+     * All parts are registered before partAdded() is emitted for each of them, and
+     * only \a activate, if not null, is made the active part. This avoids an
+     * activation change, and the GUI merge it usually triggers, for every part.
+     *
+     * addPart() is called for each part, without activating it. partAdded() is
+     * emitted for the parts it added only once all of them are added.
+     * Parts already managed are skipped.
+     *
+     * \since 6.30
+     */
+    void addParts(const QList<Part *> &parts, Part *activate = nullptr);
+
+    /*!
+     * Removes several parts from the manager at once (this does not delete the objects).
+     *
+     * If the active part is among \a parts, the active part is set to 0 once,
+     * after partRemoved() was emitted for all of them.
+     *
+     * removePart() is called for each part. partRemoved() is emitted for the
+     * parts it removed only once all of them are removed.
+     *
+     * \since 6.30
+     */
+    void removeParts(const QList<Part *> &parts);
+
     /*!
      * Sets the active part.
      *
@@ -191,11 +333,193 @@ public:
      */
     virtual QWidget *activeWidget() const;
 
+    /*!
+     * Specifies whether each managed toplevel widget has its own active part.
+     *
+     * By default there is a single active part for all the managed toplevel
+     * widgets, activating a part in one window deactivates the active part of
+     * another window. When \a perWindow is true, activating a part only deactivates
+     * the previous active part of the same window, and windowActivePartChanged()
+     * is emitted in addition to activePartChanged(). activePart() then returns
+     * the part activated last, in any window.
+     *
+     * This lets a single part manager serve all the windows of a shell.
+     *
+     * \sa addManagedTopLevelWidget(), windowActivePart()
+     * \since 6.30
+     */
+    void setActivePartPerWindow(bool perWindow);
+    /*!
+     * \sa setActivePartPerWindow
+     * \since 6.30
+     */
+    bool isActivePartPerWindow() const;
+
+    /*!
+     * Returns the active part of the managed toplevel widget \a window.
+     *
+     * Without an active part per window, this is activePart() if its widget is in \a window.
+     *
+     * \sa setActivePartPerWindow()
+     * \since 6.30
+     */
+    Part *windowActivePart(const QWidget *window) const;
+
+    /*!
+     * Returns how long the phases of the last activation change took.
+     *
+     * The same durations are logged in the kf.parts category at debug level.
+     *
+     * \since 6.30
+     */
+    ActivationTimings lastActivationTimings() const;
+
     /*!
      * Returns the list of parts being managed by the partmanager.
      */
     const QList<Part *> parts() const;
 
+    /*!
+     * Returns the outermost ancestor of \a part among the managed parts, which is
+     * \a part itself if it isn't nested, or nullptr if \a part isn't managed.
+     *
+     * A part is nested in another one if its parent object is that part. The tree
+     * of nested parts is recorded when the parts are added to the manager.
+     *
+     * \sa setAllowNestedParts()
+     * \since 6.30
+     */
+    Part *topLevelPart(Part *part) const;
+
+    /*!
+     * Returns the managed parts directly nested in \a part.
+     * \since 6.30
+     */
+    QList<Part *> childParts(Part *part) const;
+
+    /*!
+     * Returns \a part followed by all the managed parts nested in it, parents before
+     * their children. The list is empty if \a part isn't managed.
+     * \since 6.30
+     */
+    QList<Part *> subtree(Part *part) const;
+
+    /*!
+     * Sets the active part to 0 if it is \a part or nested in it, and drops
+     * such a part's pending activation.
+     * \sa subtree()
+     * \since 6.30
+     */
+    void deactivateSubtree(Part *part);
+
+    /*!
+     * Removes \a part and all the parts nested in it from the manager (this does
+     * not delete the objects).
+     * \sa subtree(), removeParts()
+     * \since 6.30
+     */
+    void removeSubtree(Part *part);
+
+    /*!
+     * Sets after how long, in milliseconds, an inactive part is suspended.
+     *
+     * Suspended parts receive a PartSuspendEvent, so that they can stop timers,
+     * animations and loads, and drop data they can recreate. They are resumed,
+     * with another PartSuspendEvent, when they are activated again. The active
+     * parts are never suspended.
+     *
+     * The default of -1 disables the automatic suspension, suspendPart() and
+     * suspendLeastRecentlyUsedParts() still work.
+     *
+     * \since 6.30
+     */
+    void setSuspendTimeout(int msec);
+    /*!
+     * \sa setSuspendTimeout
+     * \since 6.30
+     */
+    int suspendTimeout() const;
+
+    /*!
+     * Returns true if \a part is suspended.
+     * \sa setSuspendTimeout()
+     * \since 6.30
+     */
+    bool isPartSuspended(Part *part) const;
+
+    /*!
+     * Suspends \a part right away, unless it is active or not managed.
+     * \sa PartSuspendEvent
+     * \since 6.30
+     */
+    void suspendPart(Part *part);
+
+    /*!
+     * Resumes the suspended \a part without activating it, for instance
+     * because it became visible next to the active part.
+     * \since 6.30
+     */
+    void resumePart(Part *part);
+
+    /*!
+     * Hibernates \a part: its state is saved with its NavigationExtension, its
+     * widget is replaced by a lightweight placeholder in the same tab, splitter,
+     * stacked widget or layout, and the part and its widget are deleted.
+     *
+     * Clicking or focusing the placeholder restores the part (see restorePart())
+     * and activates it.
+     *
+     * The part is recreated from its plugin with \a args, which have to be the
+     * arguments it was created with, e.g. those passed to
+     * PartLoader::instantiatePart().
+     *
+     * \note The restored part is a new object. The application has to drop its
+     * pointers to \a part when partHibernated() is emitted, and pick up the new
+     * part from partRestored(), otherwise they dangle.
+     *
+     * Returns the placeholder, or nullptr if \a part can't be hibernated: it must
+     * be managed and inactive, have a NavigationExtension, plugin metadata and a
+     * widget with a parent, must neither be nested nor contain nested parts, and
+     * must not be a modified ReadWritePart.
+     *
+     * \sa partHibernated()
+     * \since 6.30
+     */
+    QWidget *hibernatePart(ReadOnlyPart *part, const QVariantList &args = {});
+
+    /*!
+     * Recreates the part hibernated in \a placeholder from its plugin, with the
+     * arguments given to hibernatePart(), puts its widget back in place of the
+     * placeholder, adds it to the manager without activating it and restores its
+     * saved state.
+     *
+     * The placeholder is deleted later. Returns the new part, or nullptr if
+     * \a placeholder is not one or the plugin could not be loaded.
+     *
+     * \sa hibernatePart(), partRestored()
+     * \since 6.30
+     */
+    ReadOnlyPart *restorePart(QWidget *placeholder);
+
+    /*!
+     * Returns true if \a widget is the placeholder of a hibernated part.
+     * \sa hibernatePart()
+     * \since 6.30
+     */
+    bool isHibernatedPlaceholder(const QWidget *widget) const;
+
+    /*!
+     * Sets the \a priority with which restorePendingParts() opens the document
+     * of \a part, higher first. The default is 0.
+     * \since 6.30
+     */
+    void setRestorePriority(Part *part, int priority);
+    /*!
+     * \sa setRestorePriority()
+     * \since 6.30
+     */
+    int restorePriority(Part *part) const;
+
     /*!
      * Adds the \a topLevel widget to the list of managed toplevel widgets.
      *
@@ -217,6 +541,34 @@ public:
      */
     int reason() const;
 
+public Q_SLOTS:
+    /*!
+     * Suspends up to \a count inactive parts, those used least recently first, and
+     * returns how many were suspended.
+     *
+     * Connect this to a notification about memory pressure to free the memory
+     * held by background parts first.
+     *
+     * \sa setSuspendTimeout()
+     * \since 6.30
+     */
+    int suspendLeastRecentlyUsedParts(int count);
+
+    /*!
+     * Opens the documents of up to \a count managed parts whose
+     * NavigationExtension deferred its restore, and returns how many were
+     * opened. A negative \a count opens all of them.
+     *
+     * The parts with a visible widget come first, then those with the highest
+     * restorePriority(), then the parts added first. A shell restoring a
+     * session can call this from a timer to load the remaining views a few at
+     * a time. Parts are also restored when they are activated.
+     *
+     * \sa NavigationExtension::setDeferredRestore()
+     * \since 6.30
+     */
+    int restorePendingParts(int count = -1);
+
 Q_SIGNALS:
     /*!
      * Emitted when a new part has been added.
@@ -234,6 +586,44 @@ Q_SIGNALS:
      **/
     void activePartChanged(KParts::Part *newPart);
 
+    /*!
+     * Emitted when the active part of the managed toplevel widget \a window
+     * has changed, when each window has its own active part.
+     * \sa setActivePartPerWindow()
+     * \since 6.30
+     **/
+    void windowActivePartChanged(const QWidget *window, KParts::Part *newPart);
+
+    /*!
+     * Emitted after \a part was suspended.
+     * \sa setSuspendTimeout()
+     * \since 6.30
+     **/
+    void partSuspended(KParts::Part *part);
+
+    /*!
+     * Emitted after \a part was resumed.
+     * \sa setSuspendTimeout()
+     * \since 6.30
+     **/
+    void partResumed(KParts::Part *part);
+
+    /*!
+     * Emitted right before the hibernated \a part is removed from the manager
+     * and deleted; \a placeholder now stands in for its widget.
+     * \sa hibernatePart()
+     * \since 6.30
+     **/
+    void partHibernated(KParts::ReadOnlyPart *part, QWidget *placeholder);
+
+    /*!
+     * Emitted after \a part was recreated in place of \a placeholder. It replaces
+     * the part given by partHibernated().
+     * \sa restorePart()
+     * \since 6.30
+     **/
+    void partRestored(QWidget *placeholder, KParts::ReadOnlyPart *part);
+
 protected:
     /*!
      * Sets whether the PartManager ignores explicit set focus requests
@@ -258,8 +648,14 @@ protected Q_SLOTS:
     void slotManagedTopLevelWidgetDestroyed();
 
 private:
+    friend class Part;
     KPARTS_NO_EXPORT Part *findPartFromWidget(QWidget *widget, const QPoint &pos);
     KPARTS_NO_EXPORT Part *findPartFromWidget(QWidget *widget);
+    KPARTS_NO_EXPORT void partWidgetChanged(Part *part, QWidget *oldWidget);
+    KPARTS_NO_EXPORT void activateAddedPart(Part *part);
+    KPARTS_NO_EXPORT void cancelPendingActivation();
+    KPARTS_NO_EXPORT void deactivateInOtherWindows(const QList<Part *> &parts);
+    KPARTS_NO_EXPORT void suspendIdleParts();
 
 private:
     std::unique_ptr<PartManagerPrivate> const d;
@@ -0,0 +1,47 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "partsuspendevent.h"
+
+using namespace KParts;
+
+class KParts::PartSuspendEventPrivate
+{
+public:
+    PartSuspendEventPrivate(bool suspended, Part *part)
+        : m_bSuspended(suspended)
+        , m_part(part)
+    {
+    }
+    const bool m_bSuspended;
+    Part *const m_part;
+};
+
+const QEvent::Type partSuspendEvent = (QEvent::Type)40517;
+
+PartSuspendEvent::PartSuspendEvent(bool suspended, Part *part)
+    : QEvent(partSuspendEvent)
+    , d(new PartSuspendEventPrivate(suspended, part))
+{
+}
+
+PartSuspendEvent::~PartSuspendEvent() = default;
+
+bool PartSuspendEvent::suspended() const
+{
+    return d->m_bSuspended;
+}
+
+Part *PartSuspendEvent::part() const
+{
+    return d->m_part;
+}
+
+bool PartSuspendEvent::test(const QEvent *event)
+{
+    return event->type() == partSuspendEvent;
+}
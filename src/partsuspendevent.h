@@ -0,0 +1,70 @@
+/*
+    This file is part of the KDE project
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef __kparts_partsuspendevent_h__
+#define __kparts_partsuspendevent_h__
+
+#include <QEvent>
+#include <kparts/kparts_export.h>
+#include <memory>
+
+namespace KParts
+{
+class Part;
+
+class PartSuspendEventPrivate;
+/*!
+ * \class KParts::PartSuspendEvent
+ * \inheaderfile KParts/PartSuspendEvent
+ * \inmodule KParts
+ *
+ * \brief This event is sent by the part manager to parts which have been inactive
+ * for a while, and again when they are about to be activated.
+ *
+ * A suspended part should stop its timers, animations and pending loads,
+ * and may drop caches or decoded data it can recreate. When resumed, which
+ * happens right before the part receives the PartActivateEvent that activates
+ * it, it should restart what it stopped.
+ *
+ * The event is sent to the part and to its widget. Parts handle it by
+ * reimplementing QObject::customEvent() and testing the event with test().
+ *
+ * \sa KParts::PartManager::setSuspendTimeout()
+ * \since 6.30
+ */
+class KPARTS_EXPORT PartSuspendEvent : public QEvent
+{
+public:
+    /*!
+     * Constructs an event suspending \a part if \a suspended is true,
+     * resuming it otherwise.
+     */
+    PartSuspendEvent(bool suspended, Part *part);
+    ~PartSuspendEvent() override;
+
+    /*!
+     * Returns true if the part is being suspended, false if it is being resumed.
+     */
+    bool suspended() const;
+
+    /*!
+     * Returns the part being suspended or resumed.
+     */
+    Part *part() const;
+
+    /*!
+     * Returns true if \a event is a PartSuspendEvent.
+     */
+    static bool test(const QEvent *event);
+
+private:
+    const std::unique_ptr<PartSuspendEventPrivate> d;
+};
+
+} // namespace
+
+#endif
@@ -22,8 +22,14 @@
 #include <KMessageBox>
 
 #include <QApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
 #include <QFileDialog>
-#include <QTemporaryFile>
+#include <QFileInfo>
+#include <QMimeDatabase>
+#include <QSaveFile>
+#include <QStandardPaths>
 
 #include <qplatformdefs.h>
 
@@ -31,8 +37,37 @@
 #include <qt_windows.h> //CreateHardLink()
 #endif
 
+#ifdef Q_OS_LINUX
+#include <linux/fs.h> // FICLONE
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
 using namespace KParts;
 
+// Layout of a recovery journal: a header (magic, version, URL), followed by
+// records made of a type and a QByteArray payload. A snapshot record is only
+// ever written as the first record, by rewriting the whole journal.
+static const quint32 s_journalMagic = 0x4b50524a; // "KPRJ"
+static const quint32 s_journalVersion = 1;
+
+enum JournalRecordType : quint8 {
+    JournalSnapshot = 1,
+    JournalOperation = 2,
+};
+
+static QString recoveryJournalPath(const QUrl &url)
+{
+    const QByteArray hash = QCryptographicHash::hash(url.adjusted(QUrl::NormalizePathSegments).toEncoded(), QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QLatin1String("/kparts-recovery/") + QString::fromLatin1(hash)
+        + QLatin1String(".journal");
+}
+
+static void writeJournalHeader(QDataStream &stream, const QUrl &url)
+{
+    stream << s_journalMagic << s_journalVersion << url;
+}
+
 ReadWritePart::ReadWritePart(QObject *parent, const KPluginMetaData &data)
     : ReadOnlyPart(*new ReadWritePartPrivate(this, data), parent)
 {
@@ -71,6 +106,182 @@ void ReadWritePart::setModified()
     setModified(true);
 }
 
+void ReadWritePart::setRecoveryJournalEnabled(bool enabled)
+{
+    Q_D(ReadWritePart);
+
+    d->m_bRecoveryJournal = enabled;
+    if (!enabled) {
+        d->removeRecoveryJournal();
+    }
+}
+
+bool ReadWritePart::isRecoveryJournalEnabled() const
+{
+    Q_D(const ReadWritePart);
+
+    return d->m_bRecoveryJournal;
+}
+
+void ReadWritePart::setSaveAsCopyEnabled(bool enabled)
+{
+    Q_D(ReadWritePart);
+
+    d->m_bSaveAsCopy = enabled;
+}
+
+bool ReadWritePart::isSaveAsCopyEnabled() const
+{
+    Q_D(const ReadWritePart);
+
+    return d->m_bSaveAsCopy;
+}
+
+bool ReadWritePart::appendToRecoveryJournal(const QByteArray &operation)
+{
+    Q_D(ReadWritePart);
+
+    return d->writeJournalRecord(JournalOperation, operation);
+}
+
+bool ReadWritePart::writeRecoverySnapshot(const QByteArray &snapshot)
+{
+    Q_D(ReadWritePart);
+
+    return d->writeJournalRecord(JournalSnapshot, snapshot);
+}
+
+bool ReadWritePart::hasRecoveryJournal(const QUrl &url)
+{
+    return !url.isEmpty() && QFileInfo::exists(recoveryJournalPath(url));
+}
+
+bool ReadWritePart::readRecoveryJournal(const QUrl &url, QByteArray *snapshot, QList<QByteArray> *operations)
+{
+    Q_ASSERT(snapshot);
+    Q_ASSERT(operations);
+
+    snapshot->clear();
+    operations->clear();
+
+    if (url.isEmpty()) {
+        return false;
+    }
+
+    QFile journal(recoveryJournalPath(url));
+    if (!journal.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&journal);
+    stream.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic;
+    quint32 version;
+    QUrl journalUrl;
+    stream >> magic >> version >> journalUrl;
+    if (stream.status() != QDataStream::Ok || magic != s_journalMagic || version > s_journalVersion) {
+        qCWarning(KPARTSLOG) << "Ignoring invalid recovery journal" << journal.fileName();
+        return false;
+    }
+
+    while (!stream.atEnd()) {
+        quint8 type;
+        QByteArray data;
+        stream >> type >> data;
+        if (stream.status() != QDataStream::Ok) {
+            // The last record was still being written when the application went away
+            break;
+        }
+        if (type == JournalSnapshot) {
+            *snapshot = data;
+            operations->clear();
+        } else if (type == JournalOperation) {
+            operations->append(data);
+        }
+    }
+    return true;
+}
+
+void ReadWritePart::removeRecoveryJournal(const QUrl &url)
+{
+    if (!url.isEmpty()) {
+        QFile::remove(recoveryJournalPath(url));
+    }
+}
+
+bool ReadWritePartPrivate::writeJournalRecord(quint8 type, const QByteArray &data)
+{
+    if (!m_bRecoveryJournal || m_url.isEmpty()) {
+        return false;
+    }
+
+    if (!m_journalUrl.isEmpty() && m_journalUrl != m_url) {
+        // The document moved to another URL (saveAs), start a journal for it
+        removeRecoveryJournal();
+    }
+
+    const QString path = recoveryJournalPath(m_url);
+    if (m_journalUrl != m_url && QFileInfo::exists(path)) {
+        // Left behind by a previous session: the application decides whether to
+        // recover it, then removes it with ReadWritePart::removeRecoveryJournal()
+        qCDebug(KPARTSLOG) << "Keeping the recovery journal of a previous session" << path;
+        return false;
+    }
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    if (type == JournalSnapshot) {
+        // Compaction: the snapshot supersedes everything recorded so far.
+        // Write it aside and only replace the journal once it is complete.
+        m_journal.reset();
+        QSaveFile snapshotFile(path);
+        if (!snapshotFile.open(QIODevice::WriteOnly)) {
+            qCWarning(KPARTSLOG) << "Could not write recovery journal" << path << snapshotFile.errorString();
+            return false;
+        }
+        QDataStream stream(&snapshotFile);
+        stream.setVersion(QDataStream::Qt_6_0);
+        writeJournalHeader(stream, m_url);
+        stream << type << data;
+        if (stream.status() != QDataStream::Ok || !snapshotFile.commit()) {
+            qCWarning(KPARTSLOG) << "Could not write recovery journal" << path << snapshotFile.errorString();
+            return false;
+        }
+        m_journalUrl = m_url;
+        return true;
+    }
+
+    if (!m_journal) {
+        auto journal = std::make_unique<QFile>(path);
+        const bool append = m_journalUrl == m_url;
+        if (!journal->open(append ? QIODevice::WriteOnly | QIODevice::Append : QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qCWarning(KPARTSLOG) << "Could not open recovery journal" << path << journal->errorString();
+            return false;
+        }
+        if (!append) {
+            QDataStream stream(journal.get());
+            stream.setVersion(QDataStream::Qt_6_0);
+            writeJournalHeader(stream, m_url);
+        }
+        m_journal = std::move(journal);
+        m_journalUrl = m_url;
+    }
+
+    QDataStream stream(m_journal.get());
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << type << data;
+    return stream.status() == QDataStream::Ok && m_journal->flush();
+}
+
+void ReadWritePartPrivate::removeRecoveryJournal()
+{
+    m_journal.reset();
+    if (!m_journalUrl.isEmpty()) {
+        QFile::remove(recoveryJournalPath(m_journalUrl));
+        m_journalUrl = QUrl();
+    }
+}
+
 bool ReadWritePart::queryClose()
 {
     Q_D(ReadWritePart);
@@ -97,36 +308,61 @@ bool ReadWritePart::queryClose()
                                                    KStandardGuiItem::save(),
                                                    KStandardGuiItem::discard());
 
-    bool abortClose = false;
-    bool handled = false;
-
     switch (res) {
     case KMessageBox::PrimaryAction:
-        Q_EMIT sigQueryClose(&handled, &abortClose);
-        if (!handled) {
-            if (d->m_url.isEmpty()) {
-                QUrl url = QFileDialog::getSaveFileUrl(parentWidget);
-                if (url.isEmpty()) {
-                    return false;
-                }
-
-                saveAs(url);
-            } else {
-                save();
-            }
-        } else if (abortClose) {
+        if (!answerQueryClose(SaveChanges) || !waitSaveComplete()) {
             return false;
         }
-        return waitSaveComplete();
-    case KMessageBox::SecondaryAction:
+        // The host may delete the part without calling closeUrl()
+        d->removeRecoveryJournal();
         return true;
+    case KMessageBox::SecondaryAction:
+        return answerQueryClose(DiscardChanges);
     default: // case KMessageBox::Cancel :
         return false;
     }
 }
 
+bool ReadWritePart::answerQueryClose(QueryCloseAnswer answer, const QUrl &saveAsUrl)
+{
+    Q_D(ReadWritePart);
+
+    if (answer == DiscardChanges) {
+        // The changes were discarded on purpose, don't offer to recover them later
+        d->removeRecoveryJournal();
+        return true;
+    }
+
+    bool abortClose = false;
+    bool handled = false;
+    Q_EMIT sigQueryClose(&handled, &abortClose);
+    if (handled) {
+        return !abortClose;
+    }
+
+    if (d->m_url.isEmpty()) {
+        QUrl url = saveAsUrl;
+        if (url.isEmpty()) {
+            QWidget *parentWidget = widget();
+            if (!parentWidget) {
+                parentWidget = QApplication::activeWindow();
+            }
+            url = QFileDialog::getSaveFileUrl(parentWidget);
+            if (url.isEmpty()) {
+                return false;
+            }
+        }
+        saveAs(url);
+    } else {
+        save();
+    }
+    return true;
+}
+
 bool ReadWritePart::closeUrl()
 {
+    Q_D(ReadWritePart);
+
     abortLoad(); // just in case
     if (isReadWrite() && isModified()) {
         if (!queryClose()) {
@@ -134,12 +370,19 @@ bool ReadWritePart::closeUrl()
         }
     }
     // Not modified => ok and delete temp file.
+    d->removeRecoveryJournal();
     return ReadOnlyPart::closeUrl();
 }
 
 bool ReadWritePart::closeUrl(bool promptToSave)
 {
-    return promptToSave ? closeUrl() : ReadOnlyPart::closeUrl();
+    Q_D(ReadWritePart);
+
+    if (promptToSave) {
+        return closeUrl();
+    }
+    d->removeRecoveryJournal();
+    return ReadOnlyPart::closeUrl();
 }
 
 bool ReadWritePart::save()
@@ -147,8 +390,8 @@ bool ReadWritePart::save()
     Q_D(ReadWritePart);
 
     d->m_saveOk = false;
-    if (d->m_file.isEmpty()) { // document was created empty
-        d->prepareSaving();
+    if (d->m_file.isEmpty() && !d->prepareSaving()) { // document was created empty
+        return false;
     }
     if (saveFile()) {
         return saveToUrl();
@@ -170,8 +413,12 @@ bool ReadWritePart::saveAs(const QUrl &url)
     d->m_originalURL = d->m_url;
     d->m_originalFilePath = d->m_file;
     d->m_url = url; // Store where to upload in saveToURL
-    d->prepareSaving();
-    bool result = save(); // Save local file and upload local file
+    bool result;
+    if (d->canSaveAsCopy()) {
+        result = d->saveAsCopy(); // Copy the unmodified local file and upload it
+    } else {
+        result = d->prepareSaving() && save(); // Save local file and upload local file
+    }
     if (result) {
         if (d->m_originalURL != d->m_url) {
             Q_EMIT urlChanged(d->m_url);
@@ -189,8 +436,8 @@ bool ReadWritePart::saveAs(const QUrl &url)
     return result;
 }
 
-// Set m_file correctly for m_url
-void ReadWritePartPrivate::prepareSaving()
+// Set m_file correctly for m_url, returns false if there is no local file to save to
+bool ReadWritePartPrivate::prepareSaving()
 {
     // Local file
     if (m_url.isLocalFile()) {
@@ -202,16 +449,154 @@ void ReadWritePartPrivate::prepareSaving()
         m_file = m_url.toLocalFile();
     } else {
         // Remote file
-        // We haven't saved yet, or we did but locally - provide a temp file
+        // We haven't saved yet, or we did but locally - use the staging file
         if (m_file.isEmpty() || !m_bTemp) {
-            QTemporaryFile tempFile;
-            tempFile.setAutoRemove(false);
-            tempFile.open();
-            m_file = tempFile.fileName();
+            const QString stagingFile = stagingFilePath(QStringLiteral("document"));
+            if (stagingFile.isEmpty()) {
+                return false;
+            }
+            m_file = stagingFile;
             m_bTemp = true;
         }
         // otherwise, we already had a temp file
     }
+    return true;
+}
+
+// Saving to a remote URL needs a local file to write to and a second name for
+// the upload job to move away. Both live in one directory created per part,
+// so that each save costs a single link() instead of creating and deleting temp files.
+// The fixed names "document" and "upload" can't collide: QTemporaryDir gives each part
+// a directory of its own, readable by the user only, a part has one document, and
+// saveToUrl() kills the previous upload job before linking "upload" again.
+// If the directory can't be created the save is canceled and an empty path returned.
+QString ReadWritePartPrivate::stagingFilePath(const QString &name)
+{
+    Q_Q(ReadWritePart);
+
+    if (!m_stagingDir) {
+        m_stagingDir = std::make_unique<QTemporaryDir>();
+    }
+    if (!m_stagingDir->isValid()) {
+        qCWarning(KPARTSLOG) << "Could not create a temporary directory for saving:" << m_stagingDir->errorString();
+        Q_EMIT q->canceled(i18n("Could not create a temporary directory to save %1: %2",
+                                m_url.toDisplayString(QUrl::PreferLocalFile),
+                                m_stagingDir->errorString()));
+        // Try again on the next save, the cause may be gone by then
+        m_stagingDir.reset();
+        return QString();
+    }
+    return m_stagingDir->filePath(name);
+}
+
+// Copies the contents of src over dest. On Linux the data is shared (reflink)
+// or copied inside the kernel when the filesystem supports it.
+static bool copyLocalFile(const QString &src, const QString &dest)
+{
+    QFile source(src);
+    QFile destination(dest);
+    if (!source.open(QIODevice::ReadOnly) || !destination.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+
+#ifdef Q_OS_LINUX
+    const int srcFd = source.handle();
+    const int destFd = destination.handle();
+#ifdef FICLONE
+    if (::ioctl(destFd, FICLONE, srcFd) == 0) {
+        return true;
+    }
+#endif
+    // Explicit offsets leave the file positions alone, for the fallback below
+    const qint64 size = source.size();
+    off64_t inOffset = 0;
+    off64_t outOffset = 0;
+    while (inOffset < size) {
+        const ssize_t copied = ::copy_file_range(srcFd, &inOffset, destFd, &outOffset, size - inOffset, 0);
+        if (copied <= 0) {
+            break;
+        }
+    }
+    if (inOffset == size) {
+        return true;
+    }
+    // Not supported between these filesystems, start over with a plain copy
+    if (outOffset > 0 && !destination.resize(0)) {
+        return false;
+    }
+#endif
+
+    QByteArray buffer;
+    while (!(buffer = source.read(256 * 1024)).isEmpty()) {
+        if (destination.write(buffer) != buffer.size()) {
+            return false;
+        }
+    }
+    return source.error() == QFileDevice::NoError && destination.flush();
+}
+
+// For parts which declared that an unmodified document is byte for byte what
+// its local file holds, saveAs() can copy that file instead of serializing the
+// document again. Only do this when the target type is the same: parts may pick
+// the output format from the file name.
+bool ReadWritePartPrivate::canSaveAsCopy() const
+{
+    Q_Q(const ReadWritePart);
+
+    if (!m_bSaveAsCopy || q->isModified() || m_originalFilePath.isEmpty() || m_originalURL.isEmpty() || m_job || m_statJob) {
+        return false;
+    }
+    if (!QFileInfo(m_originalFilePath).isFile()) {
+        return false;
+    }
+    QMimeDatabase db;
+    return db.mimeTypeForUrl(m_originalURL) == db.mimeTypeForUrl(m_url);
+}
+
+// Counterpart of prepareSaving() + save() for canSaveAsCopy()
+bool ReadWritePartPrivate::saveAsCopy()
+{
+    Q_Q(ReadWritePart);
+
+    const QString source = m_originalFilePath;
+    bool createdTempFile = false;
+    m_saveOk = false;
+
+    if (m_url.isLocalFile()) {
+        const QString dest = m_url.toLocalFile();
+        if (dest != source && !copyLocalFile(source, dest)) {
+            Q_EMIT q->canceled(QString());
+            return false;
+        }
+        if (m_bTemp) { // the previous url was remote
+            QFile::remove(source);
+            m_bTemp = false;
+        }
+        m_file = dest;
+    } else if (!m_bTemp) {
+        // Uploading needs a temp file we own, the local file stays where it is
+        const QString stagingFile = stagingFilePath(QStringLiteral("document"));
+        if (stagingFile.isEmpty()) {
+            return false;
+        }
+        if (!copyLocalFile(source, stagingFile)) {
+            Q_EMIT q->canceled(QString());
+            return false;
+        }
+        m_file = stagingFile;
+        m_bTemp = true;
+        createdTempFile = true;
+    }
+    // otherwise the temp file of the previous remote url already holds the document
+
+    if (q->saveToUrl()) {
+        return true;
+    }
+    if (createdTempFile) {
+        QFile::remove(m_file);
+        m_bTemp = false;
+    }
+    return false;
 }
 
 static inline bool makeHardLink(const QString &src, const QString &dest)
@@ -229,6 +614,7 @@ bool ReadWritePart::saveToUrl()
 
     if (d->m_url.isLocalFile()) {
         setModified(false);
+        d->removeRecoveryJournal();
         Q_EMIT completed();
         // if m_url is a local file there won't be a temp file -> nothing to remove
         Q_ASSERT(!d->m_bTemp);
@@ -243,15 +629,18 @@ bool ReadWritePart::saveToUrl()
             d->m_uploadJob->kill();
             d->m_uploadJob = nullptr;
         }
-        QTemporaryFile *tempFile = new QTemporaryFile();
-        tempFile->open();
-        QString uploadFile = tempFile->fileName();
-        delete tempFile;
+        const QString uploadFile = d->stagingFilePath(QStringLiteral("upload"));
+        if (uploadFile.isEmpty()) {
+            return false;
+        }
         QUrl uploadUrl = QUrl::fromLocalFile(uploadFile);
-        // Create hardlink
+        // Create hardlink, the upload job moves it away and m_file stays
         if (!makeHardLink(d->m_file, uploadFile)) {
-            // Uh oh, some error happened.
-            return false;
+            // Maybe a leftover from an upload that was interrupted, try again once
+            if (!QFile::remove(uploadFile) || !makeHardLink(d->m_file, uploadFile)) {
+                // Uh oh, some error happened.
+                return false;
+            }
         }
         d->m_uploadJob = KIO::file_move(uploadUrl, d->m_url, -1, KIO::Overwrite);
         KJobWidgets::setWindow(d->m_uploadJob, widget());
@@ -273,6 +662,11 @@ void ReadWritePartPrivate::slotUploadFinished(KJob *)
         QString error = m_uploadJob->errorString();
         m_uploadJob = nullptr;
         if (m_duringSaveAs) {
+            if (m_bTemp && m_originalURL.isLocalFile()) {
+                // Don't let closeUrl() delete the original local file
+                QFile::remove(m_file);
+                m_bTemp = false;
+            }
             q->setUrl(m_originalURL);
             m_file = m_originalFilePath;
         }
@@ -284,6 +678,7 @@ void ReadWritePartPrivate::slotUploadFinished(KJob *)
 
         m_uploadJob = nullptr;
         q->setModified(false);
+        removeRecoveryJournal();
         Q_EMIT q->completed();
         m_saveOk = true;
     }
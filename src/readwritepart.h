@@ -83,6 +83,45 @@ public:
      */
     virtual bool queryClose();
 
+    /*!
+     * \enum KParts::ReadWritePart::QueryCloseAnswer
+     *
+     * The choice of the user about the changes of a document being closed.
+     *
+     * \value SaveChanges
+     *        Save the document
+     * \value DiscardChanges
+     *        Drop the changes
+     *
+     * \since 6.30
+     */
+    enum QueryCloseAnswer {
+        SaveChanges,
+        DiscardChanges,
+    };
+
+    /*!
+     * Does what queryClose() does once the user chose \a answer, for hosts which
+     * asked about several documents at once, like MainWindow::queryCloseParts().
+     * Nothing is shown unless a location has to be chosen.
+     *
+     * With SaveChanges, sigQueryClose() is emitted, then the document is saved, to
+     * \a saveAsUrl if it has no URL yet (the user is asked for one if that is empty
+     * too). Unlike queryClose(), this returns once the local file is written, call
+     * waitSaveComplete() to wait for the upload to a remote URL.
+     *
+     * With DiscardChanges, the recovery journal of the document is removed, so that
+     * the part can be deleted right away.
+     *
+     * Reimplementations of queryClose() are not called.
+     *
+     * Returns false if a sigQueryClose() handler aborted closing or if no location
+     * was chosen.
+     *
+     * \since 6.30
+     */
+    bool answerQueryClose(QueryCloseAnswer answer, const QUrl &saveAsUrl = QUrl());
+
     /*!
      * Called when closing the current url (e.g. document), for instance
      * when switching to another url (note that openUrl() calls it
@@ -118,6 +157,85 @@ public:
      */
     virtual void setModified(bool modified);
 
+    /*!
+     * Enables or disables the crash recovery journal of this part.
+     *
+     * When enabled, the part can record its edit operations with
+     * appendToRecoveryJournal() and periodic snapshots of the document
+     * with writeRecoverySnapshot(). The journal is stored per URL, so that
+     * after a crash the host application can check hasRecoveryJournal()
+     * before opening the same URL again and offer to recover the changes.
+     *
+     * The journal is removed once the document was saved successfully,
+     * or when it is closed without saving.
+     *
+     * Disabled by default.
+     *
+     * \since 6.30
+     */
+    void setRecoveryJournalEnabled(bool enabled);
+
+    /*!
+     * Returns whether the crash recovery journal is enabled.
+     * \sa setRecoveryJournalEnabled()
+     * \since 6.30
+     */
+    bool isRecoveryJournalEnabled() const;
+
+    /*!
+     * Allows saveAs() to copy the local file of an unmodified document to the new
+     * location, instead of calling saveFile(), when both locations have the same
+     * MIME type. On Linux the copy shares the data with the original file when the
+     * filesystem supports it.
+     *
+     * Only enable this if saveFile() writes an unmodified document exactly as it
+     * was read, i.e. the part doesn't convert, normalize or re-encode it.
+     *
+     * Disabled by default.
+     *
+     * \since 6.30
+     */
+    void setSaveAsCopyEnabled(bool enabled);
+
+    /*!
+     * Returns whether saveAs() may copy the local file of an unmodified document.
+     * \sa setSaveAsCopyEnabled()
+     * \since 6.30
+     */
+    bool isSaveAsCopyEnabled() const;
+
+    /*!
+     * Returns true if a recovery journal left behind by a previous session
+     * exists for \a url.
+     * \since 6.30
+     */
+    static bool hasRecoveryJournal(const QUrl &url);
+
+    /*!
+     * Reads the recovery journal stored for \a url.
+     *
+     * \a snapshot is set to the last snapshot written with writeRecoverySnapshot(),
+     * or to a null QByteArray if there is none, and \a operations to the operations
+     * appended after that snapshot, in order.
+     * A record which was only partially written when the application crashed is ignored.
+     *
+     * Returns false if there is no readable journal for \a url.
+     *
+     * The journal is kept until removeRecoveryJournal() is called: until then,
+     * appendToRecoveryJournal() and writeRecoverySnapshot() fail for \a url.
+     * After applying the recovered data, the part should remove the journal
+     * and write a new snapshot, since a new session starts a new journal.
+     * \since 6.30
+     */
+    static bool readRecoveryJournal(const QUrl &url, QByteArray *snapshot, QList<QByteArray> *operations);
+
+    /*!
+     * Deletes the recovery journal stored for \a url, once it was recovered
+     * or the user declined to recover it.
+     * \since 6.30
+     */
+    static void removeRecoveryJournal(const QUrl &url);
+
 Q_SIGNALS:
     /*!
      * set handled to true, if you don't want the default handling
@@ -172,6 +290,33 @@ protected:
      */
     virtual bool saveToUrl();
 
+    /*!
+     * Appends the edit \a operation to the recovery journal of the current URL.
+     * The format of \a operation is up to the part.
+     *
+     * Does nothing and returns false if the journal is disabled,
+     * if the document has no URL yet, if a journal left behind by a previous
+     * session exists for the URL or if writing failed.
+     * \sa setRecoveryJournalEnabled(), hasRecoveryJournal()
+     * \since 6.30
+     */
+    bool appendToRecoveryJournal(const QByteArray &operation);
+
+    /*!
+     * Replaces the recovery journal of the current URL with \a snapshot,
+     * a full copy of the document in a format chosen by the part.
+     *
+     * Operations appended earlier are dropped, which keeps the journal compact.
+     * The previous journal is only replaced once the snapshot was written completely.
+     *
+     * Returns false if the journal is disabled, if the document has no URL yet,
+     * if a journal left behind by a previous session exists for the URL
+     * or if writing failed.
+     * \sa setRecoveryJournalEnabled()
+     * \since 6.30
+     */
+    bool writeRecoverySnapshot(const QByteArray &snapshot);
+
 private:
     Q_DISABLE_COPY(ReadWritePart)
 };
@@ -13,6 +13,10 @@
 #include "readwritepart.h"
 
 #include <QEventLoop>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <memory>
 
 namespace KParts
 {
@@ -31,12 +35,32 @@ public:
 
     void slotUploadFinished(KJob *job);
 
-    void prepareSaving();
+    bool prepareSaving();
+    QString stagingFilePath(const QString &name);
+    bool canSaveAsCopy() const;
+    bool saveAsCopy();
+
+    bool writeJournalRecord(quint8 type, const QByteArray &data);
+    void removeRecoveryJournal();
 
     bool m_bModified;
     bool m_bReadWrite;
     bool m_bClosing;
+    bool m_bRecoveryJournal = false;
+    bool m_bSaveAsCopy = false;
     QEventLoop m_eventLoop;
+
+    /*
+     * The crash recovery journal of the current document, kept open for cheap appends.
+     */
+    std::unique_ptr<QFile> m_journal;
+    QUrl m_journalUrl;
+
+    /*
+     * Private directory holding the local copy of a remote document and
+     * the link handed over to the upload job. Created on the first remote save.
+     */
+    std::unique_ptr<QTemporaryDir> m_stagingDir;
 };
 
 } // namespace